@@ -0,0 +1,69 @@
+// Compares Batch::sprites against calling Batch::tex for every Sprite.
+// Only the CPU side of the Batch is measured, so no App or Renderer is needed. The Sprites are
+// untextured, which leaves out texture slot lookups (the same for both paths).
+
+#include <blah.h>
+#include <chrono>
+
+using namespace Blah;
+
+namespace
+{
+	constexpr int sprite_count = 50000;
+	constexpr int frame_count = 100;
+
+	template<class F>
+	double measure(Batch& batch, F draw)
+	{
+		// warm up, so the Batch buffers have already grown to their final size
+		draw();
+		batch.clear();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < frame_count; i++)
+		{
+			draw();
+			batch.clear();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		return std::chrono::duration<double, std::milli>(end - start).count() / frame_count;
+	}
+}
+
+int main()
+{
+	Subtexture sub = Subtexture(TextureRef(), Rectf(0, 0, 16, 16));
+	Vector<Batch::Sprite> sprites;
+	sprites.reserve(sprite_count);
+
+	for (int i = 0; i < sprite_count; i++)
+	{
+		auto it = sprites.expand();
+		it->subtexture = &sub;
+		it->position = Vec2f((float)(i % 320), (float)(i / 320));
+		it->origin = Vec2f(8, 8);
+		const float scale = 1 + (i % 3) * 0.5f;
+		it->scale = Vec2f(scale, scale);
+		it->rotation = (i % 2) ? i * 0.01f : 0.0f;
+		it->color = Color::white;
+	}
+
+	Batch batch;
+
+	const double tex_ms = measure(batch, [&]()
+	{
+		for (auto& it : sprites)
+			batch.tex(*it.subtexture, it.position, it.origin, it.scale, it.rotation, it.color);
+	});
+
+	const double sprites_ms = measure(batch, [&]()
+	{
+		batch.sprites(sprites.data(), sprites.size());
+	});
+
+	Log::info("%i sprites, average of %i frames", sprite_count, frame_count);
+	Log::info("  Batch::tex     %.3f ms", tex_ms);
+	Log::info("  Batch::sprites %.3f ms (%.2fx)", sprites_ms, tex_ms / sprites_ms);
+	return 0;
+}
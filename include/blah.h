@@ -13,8 +13,10 @@
 #include "blah/containers/str.h"
 	
 #include "blah/drawing/batch.h"
+#include "blah/drawing/vectorpath.h"
 #include "blah/drawing/spritefont.h"
 #include "blah/drawing/subtexture.h"
+#include "blah/drawing/textlayout.h"
 
 #include "blah/images/aseprite.h"
 #include "blah/images/font.h"
@@ -146,6 +146,9 @@ namespace Blah
 		// Retrieves the Renderer Information
 		const RendererInfo& renderer();
 
+		// Retrieves the Renderer Statistics of the current frame
+		const RendererStats& renderer_stats();
+
 		// Gets the BackBuffer
 		const TargetRef& backbuffer();
 	}
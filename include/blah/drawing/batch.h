@@ -3,6 +3,9 @@
 #include <blah/containers/str.h>
 #include <blah/drawing/spritefont.h>
 #include <blah/drawing/subtexture.h>
+#include <blah/drawing/textlayout.h>
+#include <blah/drawing/vectorpath.h>
+#include <blah/images/image.h>
 #include <blah/math/spatial.h>
 #include <blah/math/color.h>
 #include <blah/graphics.h>
@@ -26,6 +29,75 @@ namespace Blah
 			Wash
 		};
 
+		// The maximum number of textures a single batch can sample from
+		static constexpr int max_texture_slots = 8;
+
+		// The maximum number of nested masks, one per bit of the stencil buffer
+		static constexpr int max_mask_depth = 8;
+
+		// Batch statistics, accumulated until `reset_stats` is called
+		struct Stats
+		{
+			// data uploaded to the GPU
+			int vertices = 0;
+			int indices = 0;
+			int instances = 0;
+
+			// batches in the uploaded draw list, and the draw calls issued to render them
+			int batches = 0;
+			int draw_calls = 0;
+
+			// how many times the batch had to be split, by the state that caused it
+			int layer_breaks = 0;
+			int material_breaks = 0;
+			int blend_breaks = 0;
+			int scissor_breaks = 0;
+			int texture_breaks = 0;
+			int sampler_breaks = 0;
+			int instancing_breaks = 0;
+			int mask_breaks = 0;
+			int opaque_breaks = 0;
+
+			// triangles that were drawn, or rejected by culling
+			int emitted_primitives = 0;
+			int culled_primitives = 0;
+		};
+
+		// Overdraw measured while rendering with `measure_overdraw` enabled
+		struct Overdraw
+		{
+			// How many times the pixels of the target were shaded
+			float min = 0;
+			float average = 0;
+			float max = 0;
+
+			// How many times each pixel was shaded, going from black (never) through
+			// blue, green and yellow to red (8 or more times)
+			Image heatmap;
+		};
+
+		// A single Sprite, used to submit many Sprites at once through `Batch::sprites`
+		struct Sprite
+		{
+			// The Subtexture to draw. This must be valid for the duration of the call.
+			const Subtexture* subtexture = nullptr;
+
+			// Position of the Sprite
+			Vec2f position;
+
+			// Origin of the Sprite, which scaling and rotation are relative to
+			Vec2f origin;
+
+			// Scale of the Sprite
+			Vec2f scale = Vec2f::one;
+
+			// Rotation of the Sprite, in radians
+			float rotation = 0;
+
+			// Color of the Sprite
+			Color color = Color::white;
+		};
+
 		// The name of the default uniforms to set
 		String texture_uniform = "u_texture";
 		String sampler_uniform = "u_texture_sampler";
@@ -35,6 +107,51 @@ namespace Blah
 		// This is useful for drawing Pixel Art stuff
 		bool integerize = false;
 
+		// Uploads vertices in a compact 16-byte layout instead of the default 24-byte layout.
+		// Positions are stored as 16-bit integers and texture coordinates as normalized 16-bit
+		// values, so this is meant for Pixel Art drawing where coordinates are whole pixels
+		// (see `integerize`) and texture coordinates stay within 0-1.
+		// Only the OpenGL renderer uses it, other renderers upload the default layout.
+		bool compact_vertices = false;
+
+		// Draws quads with a persistent, pre-built 16-bit index buffer instead of recording
+		// and uploading indices every frame. Triangles are stored as quads with a repeated
+		// vertex, and large batches are split into multiple draws of up to 65536 vertices.
+		// This should only be changed while the Batch is empty (ie. right after `clear`).
+		bool quad_indices = false;
+
+		// Draws textured sprites (from `tex` and `sprites`) as 40-byte instances of a shared quad,
+		// instead of 4 vertices and 6 indices each. Falls back to regular vertices when the Renderer
+		// doesn't support instancing, when using `integerize`, or while a custom Material is used.
+		bool instanced_sprites = false;
+
+		// Draws circles, rounded rectangles, their outlines and capsules as single quads that the
+		// default shader shades with a signed distance function, giving them anti-aliased edges.
+		// The `steps` arguments are ignored for these. Only applies while no custom Material is used,
+		// and expects a uniformly scaled matrix.
+		bool sdf_shapes = false;
+
+		// Skips geometry that lies entirely outside of the cull rect (see `set_cull_rect`)
+		bool culling = false;
+
+		// Applies scissors on the CPU instead of splitting the batch every time the scissor changes.
+		// Geometry fully inside the scissor is drawn as-is, geometry outside of it is skipped, and
+		// axis-aligned quads of a single color are clipped with their texture coordinates adjusted.
+		// Anything else falls back to a hardware scissor. This expects the default render matrix,
+		// where batch coordinates are target pixels, and should only be changed while the Batch is empty.
+		bool cpu_scissor = false;
+
+		// Number of textures (up to `max_texture_slots`) a batch may sample from when drawing with
+		// the default Material. Changing texture only splits the batch once every slot is in use.
+		// Batches using a custom Material always use a single texture.
+		int texture_slots = 1;
+
+		// Debug mode where `render` doesn't draw to the target, but instead counts how many times each
+		// of its pixels is shaded, using an additive counting Material and an R8 Target. The results are
+		// read back into `overdraw()`. Counts saturate at 255, and reading them back stalls the GPU,
+		// so this is only meant for profiling. Masks are not applied while measuring.
+		bool measure_overdraw = false;
+
 		// Default Sampler, set on clear
 		TextureSampler default_sampler;
 
@@ -58,6 +175,21 @@ namespace Blah
 		// Gets the current Scissor rectangle from the top of the stack
 		Rectf peek_scissor() const;
 
+		// Begins a mask. Geometry drawn until `end_mask` isn't visible, and instead marks the area
+		// that everything drawn afterwards is clipped to, until the matching `pop_mask`. Masks can be
+		// nested up to `max_mask_depth` levels, each one clipped to its parents.
+		// The mask is the geometry itself, so transparent texture pixels still count as covered and
+		// SDF shapes are tessellated while drawing a mask. Masks use the stencil buffer, so the
+		// Target needs a DepthStencil attachment, and they only apply in submission order (ie.
+		// masked drawing should stay in the same layer as its mask).
+		void push_mask();
+
+		// Ends drawing the current mask, clipping all following drawing to it
+		void end_mask();
+
+		// Pops the current mask, clearing it from the stencil buffer
+		void pop_mask();
+
 		// Pushes a blend mode
 		void push_blend(const BlendMode& blend);
 
@@ -77,8 +209,9 @@ namespace Blah
 		// Gets the current Material from the top of the stack
 		MaterialRef peek_material() const;
 
-		// Pushes a render layer. Lower values are rendered first. This is not super optimized
-		// and should generally be avoided.
+		// Pushes a render layer. Higher values are rendered first, so lower values end up on top.
+		// Draws are sorted by layer when the Batch is rendered, keeping their submission order
+		// within each layer.
 		void push_layer(int layer);
 
 		// Pops a Layer
@@ -87,6 +220,19 @@ namespace Blah
 		// Gets the current Layer from the top of the stack
 		int peek_layer() const;
 
+		// Pushes whether the following drawing is fully opaque. Opaque batches are drawn first,
+		// front-to-back with depth testing, so pixels hidden behind them are rejected instead of
+		// being shaded and blended. Translucent batches are drawn afterwards in the usual order.
+		// The draw order (layer, then submission) is used as depth, so the Target needs a depth
+		// buffer that is cleared before rendering. Opaque drawing shouldn't have transparent pixels.
+		void push_opaque(bool opaque);
+
+		// Pops the opaque flag
+		bool pop_opaque();
+
+		// Gets whether the current drawing is opaque
+		bool peek_opaque() const;
+
 		// Pushes a Color Mode for drawing Textures
 		void push_color_mode(ColorMode mode);
 
@@ -103,21 +249,48 @@ namespace Blah
 		// Sets the current texture sampler for drawing.
 		void set_sampler(const TextureSampler& sampler);
 
+		// Sets the area used for culling, in the coordinates geometry ends up in after the matrix
+		// stack. A rect with a negative size uses the back buffer bounds, which is the default.
+		// The current scissor is always applied on top of it.
+		void set_cull_rect(const Rectf& rect);
+
 		// Draws the batch to the given target
 		void render(const TargetRef& target = TargetRef());
 
 		// Draws the batch to the given target, with the provided matrix
 		void render(const TargetRef& target, const Mat4x4f& matrix);
 
+		// Uploads the current contents to the GPU, if they changed since the last upload.
+		// This is done automatically when rendering, so calling it is only needed to control
+		// when the upload happens (ex. before rendering the batch to several targets).
+		void upload();
+
+		// Uploads the current contents and freezes the batch, releasing its CPU-side copies.
+		// Rendering a frozen batch replays the uploaded meshes with the given matrix, without
+		// any recording or upload cost. Nothing can be drawn into it until it is cleared.
+		void freeze();
+
 		// Clears the batch
 		void clear();
 
+		// Gets the batch statistics since the last reset
+		const Stats& stats() const;
+
+		// Resets the batch statistics, usually done once per frame
+		void reset_stats();
+
+		// Gets the overdraw from the last render with `measure_overdraw` enabled
+		const Overdraw& overdraw() const;
+
 		// Clears and disposes all resources that the batch is using
 		void dispose();
 
 		void line(const Vec2f& from, const Vec2f& to, float t, Color color);
 		void line(const Vec2f& from, const Vec2f& to, float t, Color fromColor, Color toColor);
 
+		// Draws a line with rounded ends
+		void capsule(const Vec2f& from, const Vec2f& to, float t, Color color);
+
 		void bezier_line(const Vec2f& from, const Vec2f& b, const Vec2f& to, int steps, float t, Color color);
 		void bezier_line(const Vec2f& from, const Vec2f& b, const Vec2f& c, const Vec2f& to, int steps, float t, Color color);
 
@@ -152,6 +325,10 @@ namespace Blah
 		void arrow_head(const Vec2f& point_pos, float radians, float side_len, Color color);
 		void arrow_head(const Vec2f& point_pos, const Vec2f& from_pos, float side_len, Color color);
 
+		// Draws the triangles of a tessellated Vector Path (see `VectorPath::fill` and `VectorPath::stroke`)
+		void path(const VectorPath& path, Color color);
+		void path(const VectorPath& path, const Vec2f& pos, Color color);
+
 		void tex(const TextureRef& texture, const Vec2f& position = Vec2f::zero, Color color = Color::white);
 		void tex(const TextureRef& texture, const Vec2f& position, const Vec2f& origin, const Vec2f& scale, float rotation, Color color);
 		void tex(const TextureRef& texture, const Rectf& clip, const Vec2f& position, const Vec2f& origin, const Vec2f& scale, float rotation, Color color);
@@ -160,8 +337,14 @@ namespace Blah
 		void tex(const Subtexture& subtexture, const Vec2f& pos, const Vec2f& origin, const Vec2f& scale, float rotation, Color color);
 		void tex(const Subtexture& subtexture, const Rectf& clip, const Vec2f& pos, const Vec2f& origin, const Vec2f& scale, float rotation, Color color);
 
+		// Draws a list of Sprites. This is the same as calling `tex(subtexture, position, origin, scale, rotation, color)`
+		// for each Sprite, but transforms them in bulk without touching the matrix stack.
+		void sprites(const Sprite* sprites, int count);
+
 		void str(const SpriteFont& font, const String& text, const Vec2f& pos, Color color);
 		void str(const SpriteFont& font, const String& text, const Vec2f& pos, const Vec2f& justify, float size, Color color);
+		void str(const TextLayout& layout, const Vec2f& pos, Color color);
+		void str(const TextLayout& layout, const Vec2f& pos, float size, Color color);
 
 	private:
 
@@ -177,45 +360,186 @@ namespace Blah
 			u8 pad;
 		};
 
+		struct CompactVertex
+		{
+			i16 pos_x;
+			i16 pos_y;
+			u16 tex_x;
+			u16 tex_y;
+			Color col;
+
+			u8 mult;
+			u8 wash;
+			u8 fill;
+			u8 pad;
+		};
+
+		struct SpriteInstance
+		{
+			Vec2f origin;
+			Vec2f axis_x;
+			Vec2f axis_y;
+			u16 tex[4];
+			Color col;
+
+			u8 mult;
+			u8 wash;
+			u8 fill;
+			u8 pad;
+		};
+
+		// What the current matrix does, so vertices can skip the parts of the transform that are no-ops
+		enum class MatrixKind
+		{
+			Identity,
+			Translate,
+			ScaleTranslate,
+			General
+		};
+
+		struct CircleTable
+		{
+			int steps = 0;
+			Vector<Vec2f> points;
+		};
+
+		// Circle tables kept at once, after which the oldest one is replaced
+		static constexpr int max_circle_tables = 16;
+
+		// How a batch uses the stencil buffer for masking, and the nesting level of its mask
+		enum class MaskMode : u8
+		{
+			None,
+			Write,
+			Test,
+			Clear
+		};
+
+		struct MaskState
+		{
+			MaskMode mode = MaskMode::None;
+			u8 level = 0;
+
+			bool operator==(const MaskState& rhs) const { return mode == rhs.mode && level == rhs.level; }
+			bool operator!=(const MaskState& rhs) const { return !(*this == rhs); }
+		};
+
+		// Materials and Textures are stored as handles into the per-frame state tables, where
+		// 0 is no resource and any other value is the table index + 1. This keeps DrawBatch
+		// trivially copyable, so splitting and sorting batches doesn't touch reference counts.
 		struct DrawBatch
 		{
 			int layer;
 			int offset;
 			int elements;
-			MaterialRef material;
+			u16 material;
 			BlendMode blend;
-			TextureRef texture;
+			u16 textures[max_texture_slots];
+			int texture_count;
 			TextureSampler sampler;
 			bool flip_vertically;
+			bool instanced;
 			Rectf scissor;
+			MaskState mask;
+			bool opaque;
 
 			DrawBatch() :
 				layer(0),
 				offset(0),
 				elements(0),
+				material(0),
 				blend(BlendMode::Normal),
+				textures(),
+				texture_count(0),
 				flip_vertically(false),
-				scissor(0, 0, -1, -1) {}
+				instanced(false),
+				scissor(0, 0, -1, -1),
+				opaque(false) {}
+		};
+
+		// Uniform handles of a Shader the Batch draws with, resolved once until the Batch is cleared
+		struct ShaderUniforms
+		{
+			ShaderRef shader;
+			UniformHandle texture;
+			UniformHandle sampler;
+			UniformHandle matrix;
 		};
 
 		MaterialRef m_default_material;
+		MaterialRef m_default_instanced_material;
+		MaterialRef m_overdraw_material;
+		MaterialRef m_overdraw_instanced_material;
+		TargetRef m_overdraw_target;
+		Vector<u8> m_overdraw_counts;
+		Overdraw m_overdraw;
+		bool m_overdraw_pass = false;
 		MeshRef m_mesh;
+		MeshRef m_instance_mesh;
+		Vector<MeshRef> m_quad_meshes;
 		Mat3x2f m_matrix = Mat3x2f::identity;
+		MatrixKind m_matrix_kind = MatrixKind::Identity;
 		ColorMode m_color_mode = ColorMode::Normal;
 		u8 m_tex_mult = 255;
 		u8 m_tex_wash = 0;
+		u8 m_tex_slot = 0;
+		Stats m_stats;
+		Rectf m_scissor = Rectf(0, 0, -1, -1);
+		Rectf m_cull_rect = Rectf(0, 0, -1, -1);
+		Rectf m_cull_bounds;
+		bool m_cull_dirty = true;
 		DrawBatch m_batch;
 		Vector<Vertex> m_vertices;
+		Vector<CompactVertex> m_compact_vertices;
 		Vector<u32> m_indices;
+		Vector<SpriteInstance> m_instances;
 		Vector<Mat3x2f> m_matrix_stack;
 		Vector<Rectf> m_scissor_stack;
+		Vector<Rectf> m_mask_bounds;
+		int m_mask_depth = 0;
+		int m_mask_overflow = 0;
+		int m_mask_vertex_start = 0;
+		int m_mask_instance_start = 0;
 		Vector<BlendMode> m_blend_stack;
-		Vector<MaterialRef> m_material_stack;
+		Vector<u16> m_material_stack;
+		Vector<MaterialRef> m_material_table;
+		Vector<u16> m_material_buckets;
+		Vector<TextureRef> m_texture_table;
+		Vector<u16> m_texture_buckets;
 		Vector<ColorMode> m_color_mode_stack;
 		Vector<int> m_layer_stack;
+		Vector<bool> m_opaque_stack;
 		Vector<DrawBatch> m_batches;
-		int m_batch_insert = 0;
-
+		Vector<CircleTable> m_circle_tables;
+		int m_circle_table_next = 0;
+		Vector<Vec2f> m_arc_points;
+		Vector<u64> m_batch_keys;
+		Vector<u64> m_batch_keys_swap;
+		Vector<DrawBatch> m_draws;
+		Vector<ShaderUniforms> m_shader_uniforms;
+		bool m_frozen = false;
+		u64 m_generation = 1;
+		u64 m_uploaded_generation = 0;
+		bool m_uploaded_compact = false;
+		bool m_uploaded_quad_indices = false;
+
+		void update_matrix_kind();
+		u16 material_handle(const MaterialRef& material);
+		u16 texture_handle(const TextureRef& texture);
+		const MaterialRef& material_of(u16 handle) const;
+		const TextureRef& texture_of(u16 handle) const;
+		const ShaderUniforms& uniforms_of(const MaterialRef& material);
+		void collapse_texture_slots();
+		bool use_sdf_shapes() const;
+		bool is_culled(const float* x, const float* y, int count);
+		int scissor_overlap(const float* x, const float* y, int count) const;
+		bool scissor_points(float* x, float* y, int count, float* tex);
+		const Vec2f* circle_table(int steps);
+		const Vec2f* arc_points(float start_radians, float add, int steps);
+		void set_instanced(bool instanced);
+		bool push_sprite_instance(const Subtexture& sub, const Mat3x2f& matrix, Color color);
+		void push_sdf_quad(const Vec2f& center, const Vec2f& axis, float half_width, float half_height, float radius, float thickness, Color color);
 		void render_single_batch(DrawCall& pass, const DrawBatch& b, const Mat4x4f& matrix);
+		void render_overdraw(const TargetRef& target, const Mat4x4f& matrix);
 	};
 }
\ No newline at end of file
@@ -118,9 +118,55 @@ namespace Blah
 		// gets the character at the given codepoint
 		const Character& operator[](Codepoint codepoint) const;
 
+		// lays out the text line by line, with justification and kerning, and calls
+		// `callback(const Character&, const Vec2f& position)` for every character that has a texture
+		template<class Callback>
+		void layout(const String& text, const Vec2f& justify, Callback callback) const;
+
 	private:
 		Vector<Character> m_characters;
 		Vector<Kerning> m_kerning;
 		Vector<TextureRef> m_atlas;
 	};
-}
\ No newline at end of file
+	template<class Callback>
+	void SpriteFont::layout(const String& text, const Vec2f& justify, Callback callback) const
+	{
+		Vec2f offset = Vec2f(0, ascent + descent);
+		if (justify.x != 0)
+			offset.x -= width_of_line(text) * justify.x;
+		if (justify.y != 0)
+			offset.y -= height_of(text) * justify.y;
+
+		Codepoint last = 0;
+		for (int i = 0, l = text.length(); i < l; i += text.utf8_length(i))
+		{
+			Codepoint next = text.utf8_at(i);
+
+			if (next == '\n')
+			{
+				offset.x = 0;
+				offset.y += line_height();
+
+				if (justify.x != 0)
+					offset.x -= width_of_line(text, i + 1) * justify.x;
+
+				last = 0;
+				continue;
+			}
+
+			const auto& ch = get_character(next);
+			if (ch.subtexture.texture)
+			{
+				Vec2f at = offset + ch.offset;
+
+				if (i > 0 && text[i - 1] != '\n')
+					at.x += get_kerning(last, next);
+
+				callback(ch, at);
+			}
+
+			offset.x += ch.advance;
+			last = next;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <blah/containers/str.h>
+#include <blah/containers/vector.h>
+#include <blah/drawing/spritefont.h>
+#include <blah/math/spatial.h>
+
+namespace Blah
+{
+	// Text Layout caches the glyph quads of a string drawn with a Sprite Font,
+	// so static text can be drawn with `Batch::str` without laying it out every frame.
+	// The layout is in font units, so drawing it at a different size doesn't invalidate it.
+	class TextLayout
+	{
+	public:
+
+		// A single laid out glyph quad
+		struct Glyph
+		{
+			Vec2f draw_coords[4];
+			Vec2f tex_coords[4];
+		};
+
+		// A range of glyphs that use the same texture
+		struct Run
+		{
+			TextureRef texture;
+			int start = 0;
+			int count = 0;
+		};
+
+		TextLayout() = default;
+		TextLayout(const SpriteFont& font, const String& text, const Vec2f& justify = Vec2f::zero);
+
+		// Lays out the text, if the font, text or justification changed since the last call.
+		// The font must stay valid while the layout is used.
+		void set(const SpriteFont& font, const String& text, const Vec2f& justify = Vec2f::zero);
+
+		// Forces the text to be laid out again on the next `set`, ex. after the font was rebuilt
+		void invalidate();
+
+		// Clears the layout
+		void clear();
+
+		// The Sprite Font the text was laid out with
+		const SpriteFont* font() const { return m_font; }
+
+		// The size of the Sprite Font when the text was laid out
+		float font_size() const { return m_font_size; }
+
+		// The laid out glyph quads
+		const Vector<Glyph>& glyphs() const { return m_glyphs; }
+
+		// The glyphs, grouped by texture
+		const Vector<Run>& runs() const { return m_runs; }
+
+	private:
+		const SpriteFont* m_font = nullptr;
+		float m_font_size = 0;
+		String m_text;
+		Vec2f m_justify;
+		Vector<Glyph> m_glyphs;
+		Vector<Run> m_runs;
+	};
+}
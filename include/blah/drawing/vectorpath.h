@@ -0,0 +1,74 @@
+#pragma once
+#include <blah/containers/vector.h>
+#include <blah/math/spatial.h>
+
+namespace Blah
+{
+	// A Vector Path is a set of polygons or polylines that are tessellated into triangles once,
+	// so static vector shapes can be drawn with `Batch::path` without tessellating them every frame.
+	// The triangles are in path coordinates, and are transformed by the Batch matrix when drawn.
+	class VectorPath
+	{
+	public:
+
+		// How the segments of a stroke are joined together
+		enum class Join
+		{
+			// Segments are extended until their edges meet, falling back to a bevel past the miter limit
+			Miter,
+
+			// Segments are joined with a round arc
+			Round
+		};
+
+		VectorPath() = default;
+
+		// Begins a new sub-path at the given point
+		void move_to(const Vec2f& point);
+
+		// Adds a line from the last point to the given point
+		void line_to(const Vec2f& point);
+
+		// Adds a quadratic bezier curve from the last point, split into the given number of lines
+		void quad_to(const Vec2f& b, const Vec2f& to, int steps);
+
+		// Adds a cubic bezier curve from the last point, split into the given number of lines
+		void cubic_to(const Vec2f& b, const Vec2f& c, const Vec2f& to, int steps);
+
+		// Closes the current sub-path, connecting its last point to its first
+		void close();
+
+		// Tessellates every sub-path as a filled polygon, replacing the current triangles.
+		// Polygons may be concave, but shouldn't intersect themselves. Holes aren't supported.
+		void fill();
+
+		// Tessellates every sub-path as a line of the given thickness, replacing the current triangles.
+		// Open sub-paths have flat ends. Overlapping parts of the stroke are drawn more than once.
+		void stroke(float thickness, Join join = Join::Miter, float miter_limit = 4.0f);
+
+		// Clears the points and the triangles
+		void clear();
+
+		// The tessellated triangles, as 3 points each
+		const Vector<Vec2f>& triangles() const { return m_triangles; }
+
+	private:
+		struct SubPath
+		{
+			int start = 0;
+			int count = 0;
+			bool closed = false;
+		};
+
+		Vector<Vec2f> m_points;
+		Vector<SubPath> m_sub_paths;
+		Vector<Vec2f> m_triangles;
+		Vector<Vec2f> m_polygon;
+		Vector<int> m_indices;
+
+		const Vec2f* polygon(const SubPath& sub, int* count);
+		void fill_polygon(const Vec2f* points, int count);
+		void stroke_polygon(const Vec2f* points, int count, bool closed, float half, Join join, float miter_limit);
+		void stroke_join(const Vec2f& at, const Vec2f& n0, const Vec2f& n1, float turn, float half, Join join, float miter_limit);
+	};
+}
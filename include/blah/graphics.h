@@ -29,7 +29,8 @@ namespace Blah
 		// The type of Renderer being used
 		RendererType type = RendererType::None;
 
-		// Whether Mesh Instancing is available
+		// Whether Mesh Instancing is available.
+		// The D3D11 Renderer doesn't support instanced draws, so this is false there.
 		bool instancing = false;
 
 		// Whether the Texture origin is the bottom left.
@@ -40,7 +41,18 @@ namespace Blah
 		int max_texture_size = 0;
 	};
 
-	// Depth comparison function to use during a draw call
+	// Renderer Statistics, reset at the start of every frame.
+	// Currently only tracked by the OpenGL Renderer.
+	struct RendererStats
+	{
+		// Pipeline state changes sent to the graphics API
+		int state_changes = 0;
+
+		// Pipeline state changes skipped because the state was already set
+		int redundant_state_changes = 0;
+	};
+
+	// Depth and Stencil comparison function to use during a draw call
 	enum class Compare
 	{
 		None,
@@ -54,6 +66,19 @@ namespace Blah
 		GreatorOrEqual
 	};
 
+	// Operation applied to the Stencil buffer during a draw call
+	enum class StencilOp
+	{
+		Keep,
+		Zero,
+		Replace,
+		Increment,
+		Decrement,
+		Invert,
+		IncrementWrap,
+		DecrementWrap
+	};
+
 	// Cull mode during a draw call
 	enum class Cull
 	{
@@ -270,6 +295,30 @@ namespace Blah
 		int array_length = 0;
 	};
 
+	// A Shader Uniform resolved with `Shader::find`, so Material values can be
+	// assigned without looking the Uniform up by name every time.
+	// Handles are only valid for Materials using the Shader they were found in.
+	struct UniformHandle
+	{
+		// The Shader the Uniform belongs to
+		const Shader* shader = nullptr;
+
+		// Index into the Shader's Uniforms, or -1 if the Uniform wasn't found
+		int index = -1;
+
+		// The Value type of the Uniform
+		UniformType type = UniformType::None;
+
+		// The first Texture / Sampler register, or the first float in the Material data
+		int offset = 0;
+
+		// The number of Texture / Sampler registers, or floats, the Uniform spans
+		int length = 0;
+
+		// Whether the Uniform was found
+		explicit operator bool() const { return index >= 0; }
+	};
+
 	// Supported Vertex value types
 	enum class VertexType
 	{
@@ -370,6 +419,10 @@ namespace Blah
 
 		// Gets a list of Shader Uniforms from Shader
 		virtual const Vector<UniformInfo>& uniforms() const = 0;
+
+		// Finds the Uniform with the given name.
+		// If it doesn't exist, the returned handle is invalid.
+		UniformHandle find(const char* name) const;
 	};
 
 	// A 2D Texture held by the GPU to be used during rendering
@@ -557,24 +610,36 @@ namespace Blah
 		// Sets the texture
 		void set_texture(int register_index, const TextureRef& texture);
 
+		// Sets the texture
+		void set_texture(const UniformHandle& uniform, const TextureRef& texture, int array_index = 0);
+
 		// Gets the texture, or an empty reference if invalid
 		TextureRef get_texture(const char* name, int array_index = 0) const;
 
 		// Gets the texture, or an empty reference if invalid
 		TextureRef get_texture(int register_index) const;
 
+		// Gets the texture, or an empty reference if invalid
+		TextureRef get_texture(const UniformHandle& uniform, int array_index = 0) const;
+
 		// Sets the sampler
 		void set_sampler(const char* name, const TextureSampler& sampler, int array_index = 0);
 
 		// Sets the sampler
 		void set_sampler(int register_index, const TextureSampler& sampler);
 
+		// Sets the sampler
+		void set_sampler(const UniformHandle& uniform, const TextureSampler& sampler, int array_index = 0);
+
 		// Gets the sampler
 		TextureSampler get_sampler(const char* name, int array_index = 0) const;
 
 		// Gets the sampler
 		TextureSampler get_sampler(int register_index) const;
 
+		// Gets the sampler
+		TextureSampler get_sampler(const UniformHandle& uniform, int array_index = 0) const;
+
 		// Sets the value. `length` is the total number of floats to set
 		// For example if the uniform is a float2[4], a total of 8 float values
 		// can be set.
@@ -594,9 +659,23 @@ namespace Blah
 		void set_value(const char* name, const Vector<Mat3x2f>& value);
 		void set_value(const char* name, const Vector<Mat4x4f>& value);
 
+		// Sets the value of a Uniform found with `Shader::find`. `length` is the total number of floats to set.
+		void set_value(const UniformHandle& uniform, const float* value, i64 length);
+
+		// Shorthands to more easily assign uniform values by handle
+		void set_value(const UniformHandle& uniform, float value);
+		void set_value(const UniformHandle& uniform, const Vec2f& value);
+		void set_value(const UniformHandle& uniform, const Vec3f& value);
+		void set_value(const UniformHandle& uniform, const Vec4f& value);
+		void set_value(const UniformHandle& uniform, const Mat3x2f& value);
+		void set_value(const UniformHandle& uniform, const Mat4x4f& value);
+
 		// Gets a pointer to the values of the given Uniform, or nullptr if it doesn't exist.
 		const float* get_value(const char* name, i64* length = nullptr) const;
 
+		// Gets a pointer to the values of the given Uniform, or nullptr if it's invalid.
+		const float* get_value(const UniformHandle& uniform, i64* length = nullptr) const;
+
 		// Checks if the shader attached to the material has a uniform value with the given name
 		bool has_value(const char* name) const;
 
@@ -609,11 +688,17 @@ namespace Blah
 		// Returns the interal float buffer of all the values
 		const float* data() const;
 
+		// Changes whenever a value, texture or sampler is assigned a different value.
+		// Generations are unique across all Materials, so Renderers can use them to skip
+		// uploading values that haven't changed since the last draw.
+		u32 generation() const;
+
 	private:
 		ShaderRef m_shader;
 		Vector<TextureRef> m_textures;
 		Vector<TextureSampler> m_samplers;
 		Vector<float> m_data;
+		u32 m_generation;
 	};
 
 	// A single draw call
@@ -646,6 +731,9 @@ namespace Blah
 		// Total amount of indices to draw from the Mesh
 		i64 index_count;
 
+		// First instance in the Mesh to draw from
+		i64 instance_start;
+
 		// Total amount of instances to draw from the Mesh
 		i64 instance_count;
 
@@ -658,6 +746,28 @@ namespace Blah
 		// Blend Mode
 		BlendMode blend;
 
+		// Stencil Compare Function. The stencil test is disabled if this is None.
+		// The Target must have a DepthStencil attachment for it to have any effect.
+		Compare stencil;
+
+		// Stencil reference value, compared against the stencil buffer and written by StencilOp::Replace
+		u8 stencil_ref;
+
+		// Bits of the reference value and stencil buffer used by the comparison
+		u8 stencil_read_mask;
+
+		// Bits of the stencil buffer that can be written to
+		u8 stencil_write_mask;
+
+		// Stencil Operation when the stencil test fails
+		StencilOp stencil_fail;
+
+		// Stencil Operation when the stencil test passes but the depth test fails
+		StencilOp stencil_depth_fail;
+
+		// Stencil Operation when both the stencil and depth tests pass
+		StencilOp stencil_pass;
+
 		// Initializes a default DrawCall
 		DrawCall();
 
@@ -260,6 +260,7 @@ void App::Internal::iterate()
 
 	// Draw Frame
 	{
+		renderer->stats = RendererStats();
 		renderer->before_render();
 		if (app_config.on_render != nullptr)
 			app_config.on_render();
@@ -418,6 +419,13 @@ const RendererInfo& App::renderer()
 	return Internal::renderer->info;
 }
 
+const RendererStats& App::renderer_stats()
+{
+	BLAH_ASSERT_RUNNING();
+	BLAH_ASSERT_RENDERER();
+	return Internal::renderer->stats;
+}
+
 const TargetRef& App::backbuffer()
 {
 	BLAH_ASSERT_RUNNING();
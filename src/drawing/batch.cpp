@@ -2,6 +2,12 @@
 #include <blah/math/calc.h>
 #include <blah/app.h>
 #include "../internal/internal.h"
+#include <float.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLAH_BATCH_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace Blah;
 
@@ -15,6 +21,46 @@ namespace
 		{ 3, VertexType::UByte4, true },
 	});
 
+	const VertexFormat compact_format = VertexFormat(
+	{
+		{ 0, VertexType::Short2, false },
+		{ 1, VertexType::UShort2, true },
+		{ 2, VertexType::UByte4, true },
+		{ 3, VertexType::UByte4, true },
+	});
+
+	// Unit quad that sprite instances are expanded over
+	const VertexFormat instance_corner_format = VertexFormat(
+	{
+		{ 0, VertexType::Float2, false },
+	});
+
+	const VertexFormat instance_format = VertexFormat(
+	{
+		{ 1, VertexType::Float2, false },
+		{ 2, VertexType::Float2, false },
+		{ 3, VertexType::Float2, false },
+		{ 4, VertexType::UShort4, true },
+		{ 5, VertexType::UByte4, true },
+		{ 6, VertexType::UByte4, true },
+	});
+
+	const Vec2f instance_corners[4] = { Vec2f(0, 0), Vec2f(1, 0), Vec2f(1, 1), Vec2f(0, 1) };
+	const u16 instance_indices[6] = { 0, 1, 2, 0, 2, 3 };
+
+	u16 batch_pack_unorm16(float value)
+	{
+		return (u16)(Calc::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	// Vertex slot byte that tells the default shader to draw an SDF shape, with the
+	// mult byte holding the corner radius and the wash byte holding the outline thickness
+	constexpr u8 sdf_shape_flag = 128;
+
+	// Vertices per Mesh when using the implicit quad indices, so they fit in 16 bits
+	constexpr int quad_chunk_vertices = 65536;
+	constexpr int quad_chunk_elements = quad_chunk_vertices / 2;
+
 	Vec2f batch_shape_intersection(const Vec2f& p0, const Vec2f& p1, const Vec2f& q0, const Vec2f& q1)
 	{
 		const auto aa = p1 - p0;
@@ -24,67 +70,270 @@ namespace
 
 		return Vec2f(p0.x + t * (p1.x - p0.x), p0.y + t * (p1.y - p0.y));
 	}
+
+	// Places a draw at its position in the sorted draw list, so later draws end up in front.
+	// The depth from the caller's matrix is compressed into a slice around the draw's position
+	// instead of being replaced, so each draw stays between its neighbours. The slices stay
+	// within 0-1, which is inside the clip range of every renderer.
+	Mat4x4f batch_depth_matrix(const Mat4x4f& matrix, int index, int count)
+	{
+		const float slice = 1.0f / (count + 1);
+		const float depth = 1.0f - (index + 1) * slice;
+
+		Mat4x4f result = matrix;
+		return result * Mat4x4f::create_scale(1, 1, slice * 0.5f) * Mat4x4f::create_translation(0, 0, depth);
+	}
+
+	// Finds the handle (index + 1) of a resource in a per-frame table, adding it if it's new.
+	// The buckets are an open-addressed hash of the table, so a lookup doesn't have to scan
+	// every resource used so far. Returns 0 if the table can't hold any more handles.
+	template<class T>
+	u16 batch_table_handle(Vector<T>& table, Vector<u16>& buckets, const T& resource)
+	{
+		const auto slot = [](const void* ptr, int mask) { return (int)(((u64)(uintptr_t)ptr * 0x9E3779B97F4A7C15ull) >> 40) & mask; };
+
+		// keep the buckets at most half full, so probe sequences stay short
+		if (table.size() * 2 >= buckets.size())
+		{
+			const int size = Calc::max(64, buckets.size() * 2);
+			buckets.clear();
+			buckets.expand(size);
+
+			for (int i = 0; i < table.size(); i++)
+			{
+				int b = slot(table[i].get(), size - 1);
+				while (buckets[b] != 0)
+					b = (b + 1) & (size - 1);
+				buckets[b] = (u16)(i + 1);
+			}
+		}
+
+		const int mask = buckets.size() - 1;
+		int b = slot(resource.get(), mask);
+		while (buckets[b] != 0)
+		{
+			if (table[buckets[b] - 1] == resource)
+				return buckets[b];
+			b = (b + 1) & mask;
+		}
+
+		if (table.size() >= UINT16_MAX)
+			return 0;
+
+		table.push_back(resource);
+		buckets[b] = (u16)table.size();
+		return buckets[b];
+	}
+
+	// Maps a shading count to black, then blue, green and yellow up to red at 8 or more
+	Color batch_overdraw_color(int count)
+	{
+		static const Color stops[5] = { Color::black, Color(0, 0, 255), Color(0, 255, 0), Color(255, 255, 0), Color(255, 0, 0) };
+
+		const float t = Calc::min(count / 8.0f, 1.0f) * 4.0f;
+		const int i = Calc::min((int)t, 3);
+		return Color::lerp(stops[i], stops[i + 1], t - i);
+	}
+
+	bool batch_is_axis_aligned(const float* x, const float* y)
+	{
+		return
+			(x[0] == x[1] && y[1] == y[2] && x[2] == x[3] && y[3] == y[0]) ||
+			(y[0] == y[1] && x[1] == x[2] && y[2] == y[3] && x[3] == x[0]);
+	}
+
+	// A group of Sprites stored as structure-of-arrays, so a lane of each array belongs to one Sprite
+	struct BatchSpriteBlock
+	{
+		static constexpr int size = 4;
+
+		// each Sprite's local matrix, which is replaced by the local matrix multiplied by the Batch matrix
+		float m11[size], m12[size], m21[size], m22[size], m31[size], m32[size];
+
+		// the corners of each Sprite, indexed by [corner][sprite]
+		float in_x[4][size], in_y[4][size];
+		float out_x[4][size], out_y[4][size];
+	};
+
+	// Multiplies every Sprite in the block by the matrix, and transforms their corners
+	void batch_transform_sprites(BatchSpriteBlock& b, const Mat3x2f& mat)
+	{
+#ifdef BLAH_BATCH_SSE2
+		const __m128 l11 = _mm_loadu_ps(b.m11), l12 = _mm_loadu_ps(b.m12);
+		const __m128 l21 = _mm_loadu_ps(b.m21), l22 = _mm_loadu_ps(b.m22);
+		const __m128 l31 = _mm_loadu_ps(b.m31), l32 = _mm_loadu_ps(b.m32);
+		const __m128 a11 = _mm_set1_ps(mat.m11), a12 = _mm_set1_ps(mat.m12);
+		const __m128 a21 = _mm_set1_ps(mat.m21), a22 = _mm_set1_ps(mat.m22);
+		const __m128 a31 = _mm_set1_ps(mat.m31), a32 = _mm_set1_ps(mat.m32);
+
+		const __m128 m11 = _mm_add_ps(_mm_mul_ps(l11, a11), _mm_mul_ps(l12, a21));
+		const __m128 m12 = _mm_add_ps(_mm_mul_ps(l11, a12), _mm_mul_ps(l12, a22));
+		const __m128 m21 = _mm_add_ps(_mm_mul_ps(l21, a11), _mm_mul_ps(l22, a21));
+		const __m128 m22 = _mm_add_ps(_mm_mul_ps(l21, a12), _mm_mul_ps(l22, a22));
+		const __m128 m31 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l31, a11), _mm_mul_ps(l32, a21)), a31);
+		const __m128 m32 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l31, a12), _mm_mul_ps(l32, a22)), a32);
+
+		_mm_storeu_ps(b.m11, m11);
+		_mm_storeu_ps(b.m12, m12);
+		_mm_storeu_ps(b.m21, m21);
+		_mm_storeu_ps(b.m22, m22);
+		_mm_storeu_ps(b.m31, m31);
+		_mm_storeu_ps(b.m32, m32);
+
+		for (int i = 0; i < 4; i++)
+		{
+			const __m128 x = _mm_loadu_ps(b.in_x[i]);
+			const __m128 y = _mm_loadu_ps(b.in_y[i]);
+			_mm_storeu_ps(b.out_x[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m11), _mm_mul_ps(y, m21)), m31));
+			_mm_storeu_ps(b.out_y[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m12), _mm_mul_ps(y, m22)), m32));
+		}
+#else
+		for (int n = 0; n < BatchSpriteBlock::size; n++)
+		{
+			const Mat3x2f m = Mat3x2f(b.m11[n], b.m12[n], b.m21[n], b.m22[n], b.m31[n], b.m32[n]) * mat;
+			b.m11[n] = m.m11;
+			b.m12[n] = m.m12;
+			b.m21[n] = m.m21;
+			b.m22[n] = m.m22;
+			b.m31[n] = m.m31;
+			b.m32[n] = m.m32;
+
+			for (int i = 0; i < 4; i++)
+			{
+				b.out_x[i][n] = (b.in_x[i][n] * m.m11) + (b.in_y[i][n] * m.m21) + m.m31;
+				b.out_y[i][n] = (b.in_x[i][n] * m.m12) + (b.in_y[i][n] * m.m22) + m.m32;
+			}
+		}
+#endif
+	}
 }
 
-#define MAKE_VERTEX(vert, mat, px, py, tx, ty, c, m, w, f, cast) \
-	(vert)->pos.x = cast(((px) * (mat).m11) + ((py) * (mat).m21) + (mat).m31); \
-	(vert)->pos.y = cast(((px) * (mat).m12) + ((py) * (mat).m22) + (mat).m32); \
+// Transforms points by the current matrix, using the cheapest form its kind allows
+#define TRANSFORM_POINTS(out_x, out_y, count, pts) \
+	{ \
+		switch (m_matrix_kind) \
+		{ \
+		case MatrixKind::Identity: \
+			for (int _n = 0; _n < (count); _n++) { \
+				out_x[_n] = pts[_n * 2]; \
+				out_y[_n] = pts[_n * 2 + 1]; \
+			} \
+			break; \
+		case MatrixKind::Translate: \
+			for (int _n = 0; _n < (count); _n++) { \
+				out_x[_n] = pts[_n * 2] + m_matrix.m31; \
+				out_y[_n] = pts[_n * 2 + 1] + m_matrix.m32; \
+			} \
+			break; \
+		case MatrixKind::ScaleTranslate: \
+			for (int _n = 0; _n < (count); _n++) { \
+				out_x[_n] = (pts[_n * 2] * m_matrix.m11) + m_matrix.m31; \
+				out_y[_n] = (pts[_n * 2 + 1] * m_matrix.m22) + m_matrix.m32; \
+			} \
+			break; \
+		default: \
+			for (int _n = 0; _n < (count); _n++) { \
+				out_x[_n] = (pts[_n * 2] * m_matrix.m11) + (pts[_n * 2 + 1] * m_matrix.m21) + m_matrix.m31; \
+				out_y[_n] = (pts[_n * 2] * m_matrix.m12) + (pts[_n * 2 + 1] * m_matrix.m22) + m_matrix.m32; \
+			} \
+			break; \
+		} \
+		if (integerize) { \
+			for (int _n = 0; _n < (count); _n++) { \
+				out_x[_n] = Calc::floor(out_x[_n]); \
+				out_y[_n] = Calc::floor(out_y[_n]); \
+			} \
+		} \
+	}
+
+#define MAKE_VERTEX(vert, px, py, tx, ty, c, m, w, f) \
+	(vert)->pos.x = (px); \
+	(vert)->pos.y = (py); \
 	(vert)->tex.x = (tx); \
 	(vert)->tex.y = m_batch.flip_vertically ? 1.0f - (ty) : (ty); \
 	(vert)->col = c; \
 	(vert)->mult = m; \
 	(vert)->wash = w; \
-	(vert)->fill = f;
-	
-#define PUSH_QUAD(px0, py0, px1, py1, px2, py2, px3, py3, tx0, ty0, tx1, ty1, tx2, ty2, tx3, ty3, col0, col1, col2, col3, mult, fill, wash) \
+	(vert)->fill = f; \
+	(vert)->pad = m_tex_slot;
+
+// Positions are transformed (and culled) before anything is written to the buffers.
+// The texture (a TextureRef pointer, or null to keep the current one) is only assigned once
+// the quad is visible, so culled quads never change texture slots or break the batch.
+#define PUSH_TEXTURED_QUAD(texture, px0, py0, px1, py1, px2, py2, px3, py3, tx0, ty0, tx1, ty1, tx2, ty2, tx3, ty3, col0, col1, col2, col3, mult, fill, wash) \
 	{ \
-		m_batch.elements += 2; \
-		auto _i = m_indices.expand(6); \
-		*_i++ = (u32)m_vertices.size() + 0; \
-		*_i++ = (u32)m_vertices.size() + 1; \
-		*_i++ = (u32)m_vertices.size() + 2; \
-		*_i++ = (u32)m_vertices.size() + 0; \
-		*_i++ = (u32)m_vertices.size() + 2; \
-		*_i++ = (u32)m_vertices.size() + 3; \
-		Vertex* _v = m_vertices.expand(4); \
-		if (integerize) { \
-			MAKE_VERTEX(_v, m_matrix, px0, py0, tx0, ty0, col0, mult, fill, wash, Calc::floor); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px1, py1, tx1, ty1, col1, mult, fill, wash, Calc::floor); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px2, py2, tx2, ty2, col2, mult, fill, wash, Calc::floor); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px3, py3, tx3, ty3, col3, mult, fill, wash, Calc::floor); \
+		float _x[4], _y[4]; \
+		const float _p[8] = { (float)(px0), (float)(py0), (float)(px1), (float)(py1), (float)(px2), (float)(py2), (float)(px3), (float)(py3) }; \
+		float _t[8] = { (float)(tx0), (float)(ty0), (float)(tx1), (float)(ty1), (float)(tx2), (float)(ty2), (float)(tx3), (float)(ty3) }; \
+		TRANSFORM_POINTS(_x, _y, 4, _p); \
+		if ((culling && is_culled(_x, _y, 4)) || \
+			(cpu_scissor && !scissor_points(_x, _y, 4, (col0) == (col1) && (col1) == (col2) && (col2) == (col3) ? _t : nullptr))) { \
+			m_stats.culled_primitives += 2; \
 		} else { \
-			MAKE_VERTEX(_v, m_matrix, px0, py0, tx0, ty0, col0, mult, fill, wash, float); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px1, py1, tx1, ty1, col1, mult, fill, wash, float); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px2, py2, tx2, ty2, col2, mult, fill, wash, float); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px3, py3, tx3, ty3, col3, mult, fill, wash, float); \
+			m_stats.emitted_primitives += 2; \
+			m_generation++; \
+			if (m_batch.instanced) \
+				set_instanced(false); \
+			if (const TextureRef* _tex = (texture)) \
+				set_texture(*_tex); \
+			m_batch.elements += 2; \
+			if (!quad_indices) { \
+				auto _i = m_indices.expand(6); \
+				*_i++ = (u32)m_vertices.size() + 0; \
+				*_i++ = (u32)m_vertices.size() + 1; \
+				*_i++ = (u32)m_vertices.size() + 2; \
+				*_i++ = (u32)m_vertices.size() + 0; \
+				*_i++ = (u32)m_vertices.size() + 2; \
+				*_i++ = (u32)m_vertices.size() + 3; \
+			} \
+			Vertex* _v = m_vertices.expand(4); \
+			MAKE_VERTEX(_v, _x[0], _y[0], _t[0], _t[1], col0, mult, fill, wash); _v++; \
+			MAKE_VERTEX(_v, _x[1], _y[1], _t[2], _t[3], col1, mult, fill, wash); _v++; \
+			MAKE_VERTEX(_v, _x[2], _y[2], _t[4], _t[5], col2, mult, fill, wash); _v++; \
+			MAKE_VERTEX(_v, _x[3], _y[3], _t[6], _t[7], col3, mult, fill, wash); \
 		} \
 	}
 
+#define PUSH_QUAD(px0, py0, px1, py1, px2, py2, px3, py3, tx0, ty0, tx1, ty1, tx2, ty2, tx3, ty3, col0, col1, col2, col3, mult, fill, wash) \
+	PUSH_TEXTURED_QUAD(nullptr, px0, py0, px1, py1, px2, py2, px3, py3, tx0, ty0, tx1, ty1, tx2, ty2, tx3, ty3, col0, col1, col2, col3, mult, fill, wash)
+
+// When using the implicit quad indices, triangles are stored as quads
+// whose last vertex repeats the third, making the second triangle degenerate
 #define PUSH_TRIANGLE(px0, py0, px1, py1, px2, py2, tx0, ty0, tx1, ty1, tx2, ty2, col0, col1, col2, mult, fill, wash) \
 	{ \
-		m_batch.elements += 1; \
-		auto* _i = m_indices.expand(3); \
-		*_i++ = (u32)m_vertices.size() + 0; \
-		*_i++ = (u32)m_vertices.size() + 1; \
-		*_i++ = (u32)m_vertices.size() + 2; \
-		Vertex* _v = m_vertices.expand(3); \
-		if (integerize) { \
-			MAKE_VERTEX(_v, m_matrix, px0, py0, tx0, ty0, col0, mult, fill, wash, Calc::floor); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px1, py1, tx1, ty1, col1, mult, fill, wash, Calc::floor); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px2, py2, tx2, ty2, col2, mult, fill, wash, Calc::floor); \
+		float _x[3], _y[3]; \
+		const float _p[6] = { (float)(px0), (float)(py0), (float)(px1), (float)(py1), (float)(px2), (float)(py2) }; \
+		TRANSFORM_POINTS(_x, _y, 3, _p); \
+		if ((culling && is_culled(_x, _y, 3)) || (cpu_scissor && !scissor_points(_x, _y, 3, nullptr))) { \
+			m_stats.culled_primitives += 1; \
 		} else { \
-			MAKE_VERTEX(_v, m_matrix, px0, py0, tx0, ty0, col0, mult, fill, wash, float); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px1, py1, tx1, ty1, col1, mult, fill, wash, float); _v++; \
-			MAKE_VERTEX(_v, m_matrix, px2, py2, tx2, ty2, col2, mult, fill, wash, float); \
+			Vertex* _v; \
+			m_stats.emitted_primitives += 1; \
+			m_generation++; \
+			if (m_batch.instanced) \
+				set_instanced(false); \
+			if (!quad_indices) { \
+				m_batch.elements += 1; \
+				auto* _i = m_indices.expand(3); \
+				*_i++ = (u32)m_vertices.size() + 0; \
+				*_i++ = (u32)m_vertices.size() + 1; \
+				*_i++ = (u32)m_vertices.size() + 2; \
+				_v = m_vertices.expand(3); \
+			} else { \
+				m_batch.elements += 2; \
+				_v = m_vertices.expand(4); \
+			} \
+			MAKE_VERTEX(_v, _x[0], _y[0], tx0, ty0, col0, mult, fill, wash); _v++; \
+			MAKE_VERTEX(_v, _x[1], _y[1], tx1, ty1, col1, mult, fill, wash); _v++; \
+			MAKE_VERTEX(_v, _x[2], _y[2], tx2, ty2, col2, mult, fill, wash); \
+			if (quad_indices) \
+				_v[1] = _v[0]; \
 		} \
 	}
 
 #define INSERT_BATCH() \
 do { \
-	m_batches.expand(); \
-	for (auto i = m_batches.size() - 1; i > m_batch_insert; i --) \
-		m_batches[i] = std::move(m_batches[i - 1]); \
-	m_batches[m_batch_insert++] = m_batch; \
+	m_batches.push_back(m_batch); \
 	m_batch.offset += m_batch.elements; \
 	m_batch.elements = 0; \
 } while (0)
@@ -92,7 +341,10 @@ do { \
 // Compares a Batcher variable, and starts a new batch if it has changed
 #define SET_BATCH_VAR(variable) \
 	if (m_batch.elements > 0 && (variable) != m_batch.variable) \
+	{ \
+		m_stats.variable##_breaks++; \
 		INSERT_BATCH(); \
+	} \
 	m_batch.variable = variable;
 
 void Batch::push_matrix(const Mat3x2f& matrix, bool absolute)
@@ -102,12 +354,14 @@ void Batch::push_matrix(const Mat3x2f& matrix, bool absolute)
 		m_matrix = matrix;
 	else
 		m_matrix = matrix * m_matrix;
+	update_matrix_kind();
 }
 
 Mat3x2f Batch::pop_matrix()
 {
 	auto was = m_matrix;
 	m_matrix = m_matrix_stack.pop();
+	update_matrix_kind();
 	return was;
 }
 
@@ -118,21 +372,156 @@ Mat3x2f Batch::peek_matrix() const
 
 void Batch::push_scissor(const Rectf& scissor)
 {
-	m_scissor_stack.push_back(m_batch.scissor);
-	SET_BATCH_VAR(scissor);
+	m_scissor_stack.push_back(m_scissor);
+	m_scissor = scissor;
+	m_cull_dirty = true;
+
+	// with CPU scissoring, the batch scissor is decided per geometry
+	if (!cpu_scissor)
+	{
+		SET_BATCH_VAR(scissor);
+	}
 }
 
 Rectf Batch::pop_scissor()
 {
-	Rectf was = m_batch.scissor;
-	Rectf scissor = m_scissor_stack.pop();
-	SET_BATCH_VAR(scissor);
+	Rectf was = m_scissor;
+	Rectf scissor = m_scissor = m_scissor_stack.pop();
+	m_cull_dirty = true;
+
+	if (!cpu_scissor)
+	{
+		SET_BATCH_VAR(scissor);
+	}
+
 	return was;
 }
 
 Rectf Batch::peek_scissor() const
 {
-	return m_batch.scissor;
+	return m_scissor;
+}
+
+void Batch::push_mask()
+{
+	BLAH_ASSERT(m_batch.mask.mode != MaskMode::Write, "Cannot push a mask while drawing one");
+
+	if (m_mask_overflow > 0 || m_mask_depth >= max_mask_depth)
+	{
+		Log::warn("Batch masks can't be nested more than %i levels deep", max_mask_depth);
+		m_mask_overflow++;
+		return;
+	}
+
+	m_mask_vertex_start = m_vertices.size();
+	m_mask_instance_start = m_instances.size();
+
+	MaskState mask = { MaskMode::Write, (u8)m_mask_depth };
+	SET_BATCH_VAR(mask);
+	m_mask_depth++;
+}
+
+void Batch::end_mask()
+{
+	if (m_mask_overflow > 0)
+		return;
+
+	BLAH_ASSERT(m_batch.mask.mode == MaskMode::Write, "Ending a mask that was never pushed");
+	if (m_batch.mask.mode != MaskMode::Write)
+		return;
+
+	// find the area the mask covers, so it can be cleared when popped
+	Vec2f min = Vec2f(FLT_MAX, FLT_MAX);
+	Vec2f max = Vec2f(-FLT_MAX, -FLT_MAX);
+
+	for (int i = m_mask_vertex_start; i < m_vertices.size(); i++)
+	{
+		min = Vec2f::min(min, m_vertices[i].pos);
+		max = Vec2f::max(max, m_vertices[i].pos);
+	}
+
+	for (int i = m_mask_instance_start; i < m_instances.size(); i++)
+	{
+		const auto& it = m_instances[i];
+		const Vec2f corners[4] = { it.origin, it.origin + it.axis_x, it.origin + it.axis_x + it.axis_y, it.origin + it.axis_y };
+		for (int n = 0; n < 4; n++)
+		{
+			min = Vec2f::min(min, corners[n]);
+			max = Vec2f::max(max, corners[n]);
+		}
+	}
+
+	if (min.x < max.x && min.y < max.y)
+		m_mask_bounds.push_back(Rectf(min.x, min.y, max.x - min.x, max.y - min.y));
+	else
+		m_mask_bounds.push_back(Rectf());
+
+	MaskState mask = { MaskMode::Test, (u8)(m_mask_depth - 1) };
+	SET_BATCH_VAR(mask);
+}
+
+void Batch::pop_mask()
+{
+	if (m_mask_overflow > 0)
+	{
+		m_mask_overflow--;
+		return;
+	}
+
+	if (m_batch.mask.mode == MaskMode::Write)
+		end_mask();
+
+	BLAH_ASSERT(m_mask_depth > 0, "Popping a mask that was never pushed");
+	if (m_mask_depth <= 0)
+		return;
+
+	const Rectf bounds = m_mask_bounds.pop();
+	m_mask_depth--;
+
+	// clear this level's bit by drawing over the area the mask covered
+	if (bounds.w > 0 && bounds.h > 0)
+	{
+		MaskState mask = { MaskMode::Clear, (u8)m_mask_depth };
+		SET_BATCH_VAR(mask);
+
+		Rectf scissor = Rectf(0, 0, -1, -1);
+		SET_BATCH_VAR(scissor);
+
+		if (m_batch.instanced)
+			set_instanced(false);
+
+		if (!quad_indices)
+		{
+			auto i = m_indices.expand(6);
+			*i++ = (u32)m_vertices.size() + 0;
+			*i++ = (u32)m_vertices.size() + 1;
+			*i++ = (u32)m_vertices.size() + 2;
+			*i++ = (u32)m_vertices.size() + 0;
+			*i++ = (u32)m_vertices.size() + 2;
+			*i++ = (u32)m_vertices.size() + 3;
+		}
+
+		Vertex* v = m_vertices.expand(4);
+		MAKE_VERTEX(v, bounds.x, bounds.y, 0, 0, Color::transparent, 0, 0, 0); v++;
+		MAKE_VERTEX(v, bounds.x + bounds.w, bounds.y, 0, 0, Color::transparent, 0, 0, 0); v++;
+		MAKE_VERTEX(v, bounds.x + bounds.w, bounds.y + bounds.h, 0, 0, Color::transparent, 0, 0, 0); v++;
+		MAKE_VERTEX(v, bounds.x, bounds.y + bounds.h, 0, 0, Color::transparent, 0, 0, 0);
+
+		m_batch.elements += 2;
+		m_generation++;
+
+		// with CPU scissoring the batch scissor is decided per geometry
+		if (!cpu_scissor)
+		{
+			scissor = m_scissor;
+			SET_BATCH_VAR(scissor);
+		}
+	}
+
+	MaskState mask;
+	if (m_mask_depth > 0)
+		mask = { MaskMode::Test, (u8)(m_mask_depth - 1) };
+	SET_BATCH_VAR(mask);
 }
 
 void Batch::push_blend(const BlendMode& blend)
@@ -154,144 +543,905 @@ BlendMode Batch::peek_blend() const
 	return m_batch.blend;
 }
 
-void Batch::push_material(const MaterialRef& material)
+void Batch::push_material(const MaterialRef& ref)
 {
 	m_material_stack.push_back(m_batch.material);
+	const u16 material = material_handle(ref);
 	SET_BATCH_VAR(material);
+	collapse_texture_slots();
+}
+
+MaterialRef Batch::pop_material()
+{
+	MaterialRef was = material_of(m_batch.material);
+	u16 material = m_material_stack.pop();
+	SET_BATCH_VAR(material);
+	collapse_texture_slots();
+	return was;
+}
+
+MaterialRef Batch::peek_material() const
+{
+	return material_of(m_batch.material);
+}
+
+void Batch::push_layer(int layer)
+{
+	m_layer_stack.push_back(m_batch.layer);
+	SET_BATCH_VAR(layer);
+}
+
+int Batch::pop_layer()
+{
+	int was = m_batch.layer;
+	int layer = m_layer_stack.pop();
+	SET_BATCH_VAR(layer);
+	return was;
+}
+
+int Batch::peek_layer() const
+{
+	return m_batch.layer;
+}
+
+void Batch::push_opaque(bool opaque)
+{
+	m_opaque_stack.push_back(m_batch.opaque);
+	SET_BATCH_VAR(opaque);
+}
+
+bool Batch::pop_opaque()
+{
+	bool was = m_batch.opaque;
+	bool opaque = m_opaque_stack.pop();
+	SET_BATCH_VAR(opaque);
+	return was;
+}
+
+bool Batch::peek_opaque() const
+{
+	return m_batch.opaque;
+}
+
+void Batch::push_color_mode(ColorMode mode)
+{
+	m_color_mode_stack.push_back(m_color_mode);
+	m_color_mode = mode;
+
+	m_tex_mult = (m_color_mode == ColorMode::Normal ? 255 : 0);
+	m_tex_wash = (m_color_mode == ColorMode::Wash ? 255 : 0);
 }
 
-MaterialRef Batch::pop_material()
-{
-	MaterialRef was = m_batch.material;
-	MaterialRef material = m_material_stack.pop();
-	SET_BATCH_VAR(material);
-	return was;
+Batch::ColorMode Batch::pop_color_mode()
+{
+	ColorMode was = m_color_mode;
+	m_color_mode = m_color_mode_stack.pop();
+	m_tex_mult = (m_color_mode == ColorMode::Normal ? 255 : 0);
+	m_tex_wash = (m_color_mode == ColorMode::Wash ? 255 : 0);
+	return was;
+}
+
+Batch::ColorMode Batch::peek_color_mode() const
+{
+	return m_color_mode;
+}
+
+void Batch::set_texture(const TextureRef& texture)
+{
+	// use the slot the texture is already in
+	for (int i = 0; i < m_batch.texture_count; i++)
+	{
+		if (texture_of(m_batch.textures[i]) == texture)
+		{
+			m_tex_slot = (u8)i;
+			m_batch.flip_vertically = App::renderer().origin_bottom_left && texture->is_framebuffer();
+			return;
+		}
+	}
+
+	// break the batch if there are no free slots left
+	const int slots = (m_batch.material ? 1 : Calc::clamp(texture_slots, 1, max_texture_slots));
+	if (m_batch.elements > 0 && m_batch.texture_count > 0 && (!texture || m_batch.texture_count >= slots))
+	{
+		m_stats.texture_breaks++;
+		INSERT_BATCH();
+	}
+
+	// an empty batch doesn't need to keep its old textures
+	if (m_batch.elements <= 0)
+		m_batch.texture_count = 0;
+
+	m_tex_slot = 0;
+	if (texture)
+	{
+		m_generation++;
+		m_tex_slot = (u8)m_batch.texture_count;
+		m_batch.textures[m_batch.texture_count++] = texture_handle(texture);
+	}
+
+	m_batch.flip_vertically = App::renderer().origin_bottom_left && texture && texture->is_framebuffer();
+}
+
+void Batch::push_sdf_quad(const Vec2f& center, const Vec2f& axis, float half_width, float half_height, float radius, float thickness, Color color)
+{
+	const auto min_half = Calc::min(half_width, half_height);
+	if (min_half <= 0)
+		return;
+
+	const auto perp = Vec2f(-axis.y, axis.x);
+
+	// pad the quad by a pixel so the anti-aliased edge isn't cut off
+	const auto scale_x = Vec2f(axis.x * m_matrix.m11 + axis.y * m_matrix.m21, axis.x * m_matrix.m12 + axis.y * m_matrix.m22).length();
+	const auto scale_y = Vec2f(perp.x * m_matrix.m11 + perp.y * m_matrix.m21, perp.x * m_matrix.m12 + perp.y * m_matrix.m22).length();
+	if (scale_x <= 0 || scale_y <= 0)
+		return;
+
+	const auto ax = axis * (half_width + 1.0f / scale_x);
+	const auto ay = perp * (half_height + 1.0f / scale_y);
+	const auto p0 = center - ax - ay;
+	const auto p1 = center + ax - ay;
+	const auto p2 = center + ax + ay;
+	const auto p3 = center - ax + ay;
+
+	// shape parameters are relative to the smallest half size
+	const auto r = (u8)(Calc::clamp(radius / min_half, 0.0f, 1.0f) * 255.0f + 0.5f);
+	const auto t = (u8)(Calc::clamp(thickness / min_half, 0.0f, 1.0f) * 255.0f + 0.5f);
+
+	const auto slot = m_tex_slot;
+	m_tex_slot = sdf_shape_flag;
+
+	PUSH_QUAD(
+		p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, p3.x, p3.y,
+		0, 0, 1, 0, 1, 1, 0, 1,
+		color, color, color, color,
+		r, t, 0);
+
+	m_tex_slot = slot;
+}
+
+void Batch::set_cull_rect(const Rectf& rect)
+{
+	m_cull_rect = rect;
+	m_cull_dirty = true;
+}
+
+bool Batch::is_culled(const float* x, const float* y, int count)
+{
+	if (m_cull_dirty)
+	{
+		m_cull_bounds = m_cull_rect;
+		if (m_cull_bounds.w < 0 || m_cull_bounds.h < 0)
+		{
+			auto& backbuffer = App::backbuffer();
+			m_cull_bounds = Rectf(0, 0, (float)backbuffer->width(), (float)backbuffer->height());
+		}
+
+		if (m_scissor.w >= 0 && m_scissor.h >= 0)
+			m_cull_bounds = m_cull_bounds.overlap_rect(m_scissor);
+
+		m_cull_dirty = false;
+	}
+
+	float min_x = x[0], max_x = x[0];
+	float min_y = y[0], max_y = y[0];
+	for (int i = 1; i < count; i++)
+	{
+		min_x = Calc::min(min_x, x[i]);
+		max_x = Calc::max(max_x, x[i]);
+		min_y = Calc::min(min_y, y[i]);
+		max_y = Calc::max(max_y, y[i]);
+	}
+
+	return
+		max_x < m_cull_bounds.x || min_x > m_cull_bounds.x + m_cull_bounds.w ||
+		max_y < m_cull_bounds.y || min_y > m_cull_bounds.y + m_cull_bounds.h;
+}
+
+int Batch::scissor_overlap(const float* x, const float* y, int count) const
+{
+	if (m_scissor.w < 0 || m_scissor.h < 0)
+		return 1;
+
+	float min_x = x[0], max_x = x[0];
+	float min_y = y[0], max_y = y[0];
+	for (int i = 1; i < count; i++)
+	{
+		min_x = Calc::min(min_x, x[i]);
+		max_x = Calc::max(max_x, x[i]);
+		min_y = Calc::min(min_y, y[i]);
+		max_y = Calc::max(max_y, y[i]);
+	}
+
+	const float right = m_scissor.x + m_scissor.w;
+	const float bottom = m_scissor.y + m_scissor.h;
+
+	if (max_x <= m_scissor.x || min_x >= right || max_y <= m_scissor.y || min_y >= bottom)
+		return -1;
+	if (min_x >= m_scissor.x && max_x <= right && min_y >= m_scissor.y && max_y <= bottom)
+		return 1;
+	return 0;
+}
+
+bool Batch::scissor_points(float* x, float* y, int count, float* tex)
+{
+	const int overlap = scissor_overlap(x, y, count);
+	if (overlap < 0)
+		return false;
+
+	Rectf scissor = Rectf(0, 0, -1, -1);
+
+	// clip axis-aligned quads, interpolating their texture coordinates over the original quad
+	if (overlap == 0 && tex && count == 4 && batch_is_axis_aligned(x, y))
+	{
+		const Vec2f origin = Vec2f(x[0], y[0]);
+		const Vec2f axis_s = Vec2f(x[1], y[1]) - origin;
+		const Vec2f axis_t = Vec2f(x[3], y[3]) - origin;
+		const float len_s = axis_s.length_squared();
+		const float len_t = axis_t.length_squared();
+
+		float uv[8];
+		for (int i = 0; i < 8; i++)
+			uv[i] = tex[i];
+
+		for (int i = 0; i < 4; i++)
+		{
+			x[i] = Calc::clamp(x[i], m_scissor.x, m_scissor.x + m_scissor.w);
+			y[i] = Calc::clamp(y[i], m_scissor.y, m_scissor.y + m_scissor.h);
+
+			const Vec2f local = Vec2f(x[i], y[i]) - origin;
+			const float s = (len_s > 0 ? Vec2f::dot(local, axis_s) / len_s : 0);
+			const float t = (len_t > 0 ? Vec2f::dot(local, axis_t) / len_t : 0);
+
+			for (int n = 0; n < 2; n++)
+			{
+				tex[i * 2 + n] =
+					uv[0 + n] * (1 - s) * (1 - t) +
+					uv[2 + n] * s * (1 - t) +
+					uv[4 + n] * s * t +
+					uv[6 + n] * (1 - s) * t;
+			}
+		}
+	}
+	else if (overlap == 0)
+		scissor = m_scissor;
+
+	// geometry that doesn't need the scissor can still join a batch that uses the current one
+	if (scissor.w < 0 && m_batch.scissor == m_scissor)
+		return true;
+
+	SET_BATCH_VAR(scissor);
+	return true;
+}
+
+void Batch::set_instanced(bool instanced)
+{
+	if (m_batch.elements > 0)
+	{
+		m_stats.instancing_breaks++;
+		INSERT_BATCH();
+	}
+
+	// instanced batches index into the instances instead of the triangles
+	m_batch.instanced = instanced;
+	if (instanced)
+		m_batch.offset = m_instances.size();
+	else
+		m_batch.offset = (quad_indices ? m_vertices.size() / 2 : m_indices.size() / 3);
+}
+
+bool Batch::push_sprite_instance(const Subtexture& sub, const Mat3x2f& matrix, Color color)
+{
+	if (!instanced_sprites || integerize || m_batch.material || !sub.texture ||
+		!App::renderer().instancing || !App::Internal::renderer->default_batcher_instanced_shader)
+		return false;
+
+	const Vec2f* pos = sub.draw_coords;
+	const Vec2f* tex = sub.tex_coords;
+	const Vec2f local_x = pos[1] - pos[0];
+	const Vec2f local_y = pos[3] - pos[0];
+
+	const Vec2f origin = Vec2f(
+		(pos[0].x * matrix.m11) + (pos[0].y * matrix.m21) + matrix.m31,
+		(pos[0].x * matrix.m12) + (pos[0].y * matrix.m22) + matrix.m32);
+	const Vec2f axis_x = Vec2f(
+		(local_x.x * matrix.m11) + (local_x.y * matrix.m21),
+		(local_x.x * matrix.m12) + (local_x.y * matrix.m22));
+	const Vec2f axis_y = Vec2f(
+		(local_y.x * matrix.m11) + (local_y.y * matrix.m21),
+		(local_y.x * matrix.m12) + (local_y.y * matrix.m22));
+
+	if (culling || cpu_scissor)
+	{
+		float x[4] = { origin.x, origin.x + axis_x.x, origin.x + axis_x.x + axis_y.x, origin.x + axis_y.x };
+		float y[4] = { origin.y, origin.y + axis_x.y, origin.y + axis_x.y + axis_y.y, origin.y + axis_y.y };
+
+		// partially scissored sprites are drawn as regular quads, so they can be clipped
+		if (cpu_scissor && scissor_overlap(x, y, 4) == 0)
+			return false;
+
+		if ((culling && is_culled(x, y, 4)) || (cpu_scissor && !scissor_points(x, y, 4, nullptr)))
+		{
+			m_stats.culled_primitives += 2;
+			return true;
+		}
+	}
+
+	if (!m_batch.instanced)
+		set_instanced(true);
+	set_texture(sub.texture);
+
+	auto it = m_instances.expand();
+	it->origin = origin;
+	it->axis_x = axis_x;
+	it->axis_y = axis_y;
+	it->tex[0] = batch_pack_unorm16(tex[0].x);
+	it->tex[1] = batch_pack_unorm16(m_batch.flip_vertically ? 1.0f - tex[0].y : tex[0].y);
+	it->tex[2] = batch_pack_unorm16(tex[2].x);
+	it->tex[3] = batch_pack_unorm16(m_batch.flip_vertically ? 1.0f - tex[2].y : tex[2].y);
+	it->col = color;
+	it->mult = m_tex_mult;
+	it->wash = m_tex_wash;
+	it->fill = 0;
+	it->pad = m_tex_slot;
+
+	m_stats.emitted_primitives += 2;
+	m_batch.elements++;
+	m_generation++;
+	return true;
+}
+
+u16 Batch::material_handle(const MaterialRef& material)
+{
+	if (!material)
+		return 0;
+
+	const u16 handle = batch_table_handle(m_material_table, m_material_buckets, material);
+	if (handle == 0)
+		Log::warn("Too many Materials used in a single Batch, falling back to the default Material");
+	return handle;
+}
+
+u16 Batch::texture_handle(const TextureRef& texture)
+{
+	if (!texture)
+		return 0;
+
+	const u16 handle = batch_table_handle(m_texture_table, m_texture_buckets, texture);
+	if (handle == 0)
+		Log::warn("Too many Textures used in a single Batch, drawing without a Texture");
+	return handle;
+}
+
+const MaterialRef& Batch::material_of(u16 handle) const
+{
+	static const MaterialRef none;
+	return (handle > 0 ? m_material_table[handle - 1] : none);
+}
+
+const TextureRef& Batch::texture_of(u16 handle) const
+{
+	static const TextureRef none;
+	return (handle > 0 ? m_texture_table[handle - 1] : none);
+}
+
+bool Batch::use_sdf_shapes() const
+{
+	// masks are the drawn geometry, so they need the real shapes
+	return sdf_shapes && !m_batch.material && m_batch.mask.mode != MaskMode::Write;
+}
+
+void Batch::update_matrix_kind()
+{
+	if (m_matrix.m12 != 0 || m_matrix.m21 != 0)
+		m_matrix_kind = MatrixKind::General;
+	else if (m_matrix.m11 != 1 || m_matrix.m22 != 1)
+		m_matrix_kind = MatrixKind::ScaleTranslate;
+	else if (m_matrix.m31 != 0 || m_matrix.m32 != 0)
+		m_matrix_kind = MatrixKind::Translate;
+	else
+		m_matrix_kind = MatrixKind::Identity;
+}
+
+void Batch::collapse_texture_slots()
+{
+	// custom materials can only sample from the first slot, so move the current texture there
+	if (m_batch.material && m_batch.elements <= 0 && m_batch.texture_count > 1)
+	{
+		m_batch.textures[0] = m_batch.textures[m_tex_slot];
+		m_batch.texture_count = 1;
+		m_tex_slot = 0;
+	}
+}
+
+void Batch::set_sampler(const TextureSampler& sampler)
+{
+	if (m_batch.elements > 0 && sampler != m_batch.sampler)
+	{
+		m_stats.sampler_breaks++;
+		INSERT_BATCH();
+	}
+
+	m_batch.sampler = sampler;
+}
+
+void Batch::render(const TargetRef& target)
+{
+	TargetRef ref = (target ? target : App::backbuffer());
+	render(ref, Mat4x4f::create_ortho_offcenter(0, (float)ref->width(), (float)ref->height(), 0, 0.01f, 1000.0f));
+}
+
+void Batch::render(const TargetRef& target, const Mat4x4f& matrix)
+{
+	BLAH_ASSERT(!m_frozen || m_vertices.size() <= 0, "Cannot draw into a frozen Batch before clearing it");
+
+	upload();
+
+	if (measure_overdraw)
+	{
+		render_overdraw(target, matrix);
+		return;
+	}
+
+	// nothing to draw
+	if (m_draws.size() <= 0)
+		return;
+
+	if (!m_default_material)
+	{
+		BLAH_ASSERT_RENDERER();
+		m_default_material = Material::create(App::Internal::renderer->default_batcher_shader);
+	}
+
+	DrawCall pass;
+	pass.target = target;
+	pass.mesh = m_mesh;
+	pass.has_viewport = false;
+	pass.viewport = Rectf();
+	pass.instance_count = 0;
+	pass.depth = Compare::None;
+	pass.cull = Cull::None;
+
+	// masked opaque batches have to wait for the mask they're clipped by, so only unmasked
+	// ones are drawn ahead of everything else
+	const auto pre_pass = [](const DrawBatch& b) { return b.opaque && b.mask.mode == MaskMode::None; };
+
+	bool has_opaque = false;
+	for (auto& it : m_draws)
+		has_opaque |= pre_pass(it);
+
+	if (!has_opaque)
+	{
+		for (auto& it : m_draws)
+			render_single_batch(pass, it, matrix);
+		return;
+	}
+
+	// draw opaque batches front-to-back, then the rest back-to-front, each at the depth of its
+	// position in the draw list. Draws keep their submission order within themselves, so equal
+	// depths have to pass for later sprites to end up on top. Mask writes and clears only touch
+	// the stencil buffer, so they skip the depth test (which also leaves the depth unwritten).
+	const int count = m_draws.size();
+
+	for (int i = count - 1; i >= 0; i--)
+	{
+		if (pre_pass(m_draws[i]))
+		{
+			pass.depth = Compare::LessOrEqual;
+			render_single_batch(pass, m_draws[i], batch_depth_matrix(matrix, i, count));
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		const auto& it = m_draws[i];
+		if (!pre_pass(it))
+		{
+			const bool stencil_only = (it.mask.mode == MaskMode::Write || it.mask.mode == MaskMode::Clear);
+			pass.depth = (stencil_only ? Compare::None : Compare::LessOrEqual);
+			render_single_batch(pass, it, batch_depth_matrix(matrix, i, count));
+		}
+	}
+}
+
+void Batch::freeze()
+{
+	upload();
+
+	// the uploaded meshes and draw list are all that's needed from now on
+	m_vertices.dispose();
+	m_compact_vertices.dispose();
+	m_indices.dispose();
+	m_instances.dispose();
+	m_batches.dispose();
+	m_batch_keys.dispose();
+	m_batch_keys_swap.dispose();
+	m_batch.offset = 0;
+	m_batch.elements = 0;
+	m_frozen = true;
+}
+
+void Batch::upload()
+{
+	const bool compact = compact_vertices && App::renderer().type == RendererType::OpenGL;
+
+	// already up to date
+	if (m_frozen || (m_uploaded_generation == m_generation && m_uploaded_compact == compact && m_uploaded_quad_indices == quad_indices))
+		return;
+
+	m_uploaded_generation = m_generation;
+	m_uploaded_compact = compact;
+	m_uploaded_quad_indices = quad_indices;
+	m_draws.clear();
+
+	// nothing to upload
+	if ((m_batches.size() <= 0 && m_batch.elements <= 0) || (m_vertices.size() <= 0 && m_instances.size() <= 0))
+		return;
+
+	if (!m_mesh)
+		m_mesh = Mesh::create();
+
+	// pack vertices
+	const void* vertices = m_vertices.data();
+	const VertexFormat* vertex_format = &format;
+
+	if (compact)
+	{
+		m_compact_vertices.clear();
+		auto dst = m_compact_vertices.expand(m_vertices.size());
+
+		for (auto& it : m_vertices)
+		{
+			dst->pos_x = (i16)Calc::clamp(Calc::round(it.pos.x), -32768.0f, 32767.0f);
+			dst->pos_y = (i16)Calc::clamp(Calc::round(it.pos.y), -32768.0f, 32767.0f);
+			dst->tex_x = batch_pack_unorm16(it.tex.x);
+			dst->tex_y = batch_pack_unorm16(it.tex.y);
+			dst->col = it.col;
+			dst->mult = it.mult;
+			dst->wash = it.wash;
+			dst->fill = it.fill;
+			dst->pad = it.pad;
+			dst++;
+		}
+
+		vertices = m_compact_vertices.data();
+		vertex_format = &compact_format;
+	}
+
+	// upload data
+	if (!quad_indices)
+	{
+		m_mesh->index_data(IndexFormat::UInt32, m_indices.data(), m_indices.size());
+		m_mesh->vertex_data(*vertex_format, vertices, m_vertices.size());
+	}
+	else
+	{
+		// split the vertices into chunks small enough for 16-bit indices, which all
+		// share the same quad index pattern that is only uploaded when a chunk is created
+		const int chunks = (m_vertices.size() + quad_chunk_vertices - 1) / quad_chunk_vertices;
+
+		if (m_quad_meshes.size() < chunks)
+		{
+			Vector<u16> indices;
+			auto _i = indices.expand(quad_chunk_elements * 3);
+			for (int n = 0; n < quad_chunk_vertices; n += 4)
+			{
+				*_i++ = (u16)(n + 0);
+				*_i++ = (u16)(n + 1);
+				*_i++ = (u16)(n + 2);
+				*_i++ = (u16)(n + 0);
+				*_i++ = (u16)(n + 2);
+				*_i++ = (u16)(n + 3);
+			}
+
+			while (m_quad_meshes.size() < chunks)
+			{
+				auto mesh = Mesh::create();
+				mesh->index_data(IndexFormat::UInt16, indices.data(), indices.size());
+				m_quad_meshes.push_back(mesh);
+			}
+		}
+
+		for (int i = 0; i < chunks; i++)
+		{
+			const int start = i * quad_chunk_vertices;
+			const int count = Calc::min(quad_chunk_vertices, m_vertices.size() - start);
+			m_quad_meshes[i]->vertex_data(*vertex_format, (const u8*)vertices + (size_t)start * vertex_format->stride, count);
+		}
+	}
+
+	// upload sprite instances
+	if (m_instances.size() > 0)
+	{
+		if (!m_instance_mesh)
+		{
+			m_instance_mesh = Mesh::create();
+			m_instance_mesh->index_data(IndexFormat::UInt16, instance_indices, 6);
+			m_instance_mesh->vertex_data(instance_corner_format, instance_corners, 4);
+		}
+
+		m_instance_mesh->instance_data(instance_format, m_instances.data(), m_instances.size());
+	}
+
+	m_stats.vertices += m_vertices.size();
+	m_stats.indices += (quad_indices ? 0 : m_indices.size());
+	m_stats.instances += m_instances.size();
+
+	// sort batches by layer
+	// keys are the (inverted) layer in the upper 32 bits, and the submission index in the lower 32 bits.
+	// the batches are already in submission order, so only the layer bytes need to be radix sorted.
+	const int count = m_batches.size() + (m_batch.elements > 0 ? 1 : 0);
+
+	m_batch_keys.clear();
+	m_batch_keys_swap.clear();
+	auto keys = m_batch_keys.expand(count);
+	auto swap = m_batch_keys_swap.expand(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		const DrawBatch& b = (i < m_batches.size() ? m_batches[i] : m_batch);
+		const u32 layer = ~((u32)b.layer ^ 0x80000000u);
+		keys[i] = ((u64)layer << 32) | (u32)i;
+	}
+
+	for (int shift = 32; shift < 64; shift += 8)
+	{
+		int offsets[256] = { 0 };
+		for (int i = 0; i < count; i++)
+			offsets[(keys[i] >> shift) & 0xFF]++;
+
+		// every key has the same digit, nothing to do for this pass
+		if (offsets[(keys[0] >> shift) & 0xFF] == count)
+			continue;
+
+		for (int i = 0, total = 0; i < 256; i++)
+		{
+			const int n = offsets[i];
+			offsets[i] = total;
+			total += n;
+		}
+
+		for (int i = 0; i < count; i++)
+			swap[offsets[(keys[i] >> shift) & 0xFF]++] = keys[i];
+
+		std::swap(keys, swap);
+	}
+
+	auto same_textures = [](const DrawBatch& a, const DrawBatch& b)
+	{
+		if (a.texture_count != b.texture_count)
+			return false;
+		for (int i = 0; i < a.texture_count; i++)
+			if (a.textures[i] != b.textures[i])
+				return false;
+		return true;
+	};
+
+	// build the draw list, merging adjacent batches that share the same state
+	for (int i = 0; i < count; i++)
+	{
+		const u32 index = (u32)keys[i];
+		const DrawBatch& b = (index < (u32)m_batches.size() ? m_batches[index] : m_batch);
+
+		if (m_draws.size() > 0)
+		{
+			auto& last = m_draws.back();
+			if (last.offset + last.elements == b.offset &&
+				last.material == b.material &&
+				last.instanced == b.instanced &&
+				last.blend == b.blend &&
+				last.sampler == b.sampler &&
+				last.scissor == b.scissor &&
+				last.mask == b.mask &&
+				last.opaque == b.opaque &&
+				same_textures(last, b))
+			{
+				last.elements += b.elements;
+				continue;
+			}
+		}
+
+		m_draws.push_back(b);
+	}
+
+	m_stats.batches += m_draws.size();
 }
 
-MaterialRef Batch::peek_material() const
+const Batch::ShaderUniforms& Batch::uniforms_of(const MaterialRef& material)
 {
-	return m_batch.material;
+	auto shader = material->shader();
+
+	for (auto& it : m_shader_uniforms)
+		if (it.shader == shader)
+			return it;
+
+	auto uniforms = m_shader_uniforms.expand();
+	uniforms->shader = shader;
+	uniforms->texture = shader->find(texture_uniform);
+	uniforms->sampler = shader->find(sampler_uniform);
+	uniforms->matrix = shader->find(matrix_uniform);
+	return *uniforms;
 }
 
-void Batch::push_layer(int layer)
+void Batch::render_single_batch(DrawCall& pass, const DrawBatch& b, const Mat4x4f& matrix)
 {
-	m_layer_stack.push_back(m_batch.layer);
-
-	if (layer != m_batch.layer)
+	// get the material
+	pass.material = material_of(b.material);
+	if (m_overdraw_pass)
+		pass.material = (b.instanced ? m_overdraw_instanced_material : m_overdraw_material);
+	else if (b.instanced)
 	{
-		INSERT_BATCH();
-
-		// TODO:
-		// binary search
-		auto insert = 0;
-		while (insert < m_batches.size() && m_batches[insert].layer >= layer)
-			insert++;
-
-		m_batch.layer = layer;
-		m_batch_insert = insert;
+		if (!m_default_instanced_material)
+			m_default_instanced_material = Material::create(App::Internal::renderer->default_batcher_instanced_shader);
+		pass.material = m_default_instanced_material;
 	}
-}
+	else if (!pass.material)
+		pass.material = m_default_material;
 
-int Batch::pop_layer()
-{
-	int was = m_batch.layer;
-	int layer = m_layer_stack.pop();
+	auto& uniforms = uniforms_of(pass.material);
 
-	if (layer != was)
+	// assign textures & sampler, fallback to whatever the first one is if the names are different.
+	// the overdraw counting materials have no textures to assign
+	if (!m_overdraw_pass)
 	{
-		INSERT_BATCH();
+		const int texture_count = Calc::max(1, b.texture_count);
 
-		// TODO:
-		// binary search
-		auto insert = 0;
-		while (insert < m_batches.size() && m_batches[insert].layer >= layer)
-			insert++;
+		if (uniforms.texture)
+		{
+			for (int i = 0; i < texture_count; i++)
+				pass.material->set_texture(uniforms.texture, texture_of(b.textures[i]), i);
+		}
+		else
+			pass.material->set_texture(0, texture_of(b.textures[0]));
 
-		m_batch.layer = layer;
-		m_batch_insert = insert;
+		if (uniforms.sampler)
+		{
+			for (int i = 0; i < texture_count; i++)
+				pass.material->set_sampler(uniforms.sampler, b.sampler, i);
+		}
+		else
+			pass.material->set_sampler(0, b.sampler);
 	}
 
-	return was;
-}
+	// assign the matrix uniform
+	if (uniforms.matrix)
+		pass.material->set_value(uniforms.matrix, matrix);
+	else
+		Log::warn("No Uniform '%s' exists", matrix_uniform.cstr());
 
-int Batch::peek_layer() const
-{
-	return m_batch.layer;
-}
+	pass.blend = b.blend;
+	pass.has_scissor = b.scissor.w >= 0 && b.scissor.h >= 0;
+	pass.scissor = b.scissor;
 
-void Batch::push_color_mode(ColorMode mode)
-{
-	m_color_mode_stack.push_back(m_color_mode);
-	m_color_mode = mode;
+	// masks use one bit of the stencil buffer per nesting level
+	{
+		const u8 level = (u8)(1 << b.mask.level);
+		const u8 parents = (u8)(level - 1);
 
-	m_tex_mult = (m_color_mode == ColorMode::Normal ? 255 : 0);
-	m_tex_wash = (m_color_mode == ColorMode::Wash ? 255 : 0);
-}
+		pass.stencil = Compare::None;
+		pass.stencil_fail = StencilOp::Keep;
+		pass.stencil_depth_fail = StencilOp::Keep;
+		pass.stencil_pass = StencilOp::Keep;
 
-Batch::ColorMode Batch::pop_color_mode()
-{
-	ColorMode was = m_color_mode;
-	m_color_mode = m_color_mode_stack.pop();
-	m_tex_mult = (m_color_mode == ColorMode::Normal ? 255 : 0);
-	m_tex_wash = (m_color_mode == ColorMode::Wash ? 255 : 0);
-	return was;
-}
+		switch (b.mask.mode)
+		{
+		case MaskMode::None:
+			break;
+
+		// mark this level, wherever all the parent levels are marked
+		case MaskMode::Write:
+			pass.stencil = Compare::Equal;
+			pass.stencil_ref = level | parents;
+			pass.stencil_read_mask = parents;
+			pass.stencil_write_mask = level;
+			pass.stencil_pass = StencilOp::Replace;
+			pass.blend.mask = BlendMask::None;
+			break;
+
+		// draw wherever this level and all its parents are marked
+		case MaskMode::Test:
+			pass.stencil = Compare::Equal;
+			pass.stencil_ref = level | parents;
+			pass.stencil_read_mask = level | parents;
+			pass.stencil_write_mask = 0;
+			break;
+
+		// unmark this level
+		case MaskMode::Clear:
+			pass.stencil = Compare::Always;
+			pass.stencil_ref = 0;
+			pass.stencil_read_mask = 0;
+			pass.stencil_write_mask = level;
+			pass.stencil_depth_fail = StencilOp::Zero;
+			pass.stencil_pass = StencilOp::Zero;
+			pass.blend.mask = BlendMask::None;
+			break;
+		}
+	}
 
-Batch::ColorMode Batch::peek_color_mode() const
-{
-	return m_color_mode;
-}
+	// count every fragment, including the ones masks would hide
+	if (m_overdraw_pass)
+	{
+		pass.blend = BlendMode(BlendOp::Add, BlendFactor::One, BlendFactor::One);
+		pass.blend.mask = BlendMask::Red;
+		pass.stencil = Compare::None;
 
-void Batch::set_texture(const TextureRef& texture)
-{
-	if (m_batch.elements > 0 && texture != m_batch.texture && m_batch.texture)
-		INSERT_BATCH();
+		// mask geometry and clears don't shade anything visible
+		if (b.mask.mode == MaskMode::Write || b.mask.mode == MaskMode::Clear)
+			return;
+	}
 
-	if (m_batch.texture != texture)
+	if (b.instanced)
 	{
-		m_batch.texture = texture;
-		m_batch.flip_vertically = App::renderer().origin_bottom_left && texture && texture->is_framebuffer();
+		pass.mesh = m_instance_mesh;
+		pass.index_start = 0;
+		pass.index_count = 6;
+		pass.instance_start = b.offset;
+		pass.instance_count = b.elements;
+		pass.perform();
+		m_stats.draw_calls++;
+
+		pass.instance_start = 0;
+		pass.instance_count = 0;
 	}
-}
+	else if (!quad_indices)
+	{
+		pass.mesh = m_mesh;
+		pass.index_start = (i64)b.offset * 3;
+		pass.index_count = (i64)b.elements * 3;
+		pass.perform();
+		m_stats.draw_calls++;
+	}
+	else
+	{
+		// draw the part of the batch that lies within each chunk
+		for (int start = b.offset, end = b.offset + b.elements; start < end;)
+		{
+			const int chunk = start / quad_chunk_elements;
+			const int chunk_end = Calc::min(end, (chunk + 1) * quad_chunk_elements);
 
-void Batch::set_sampler(const TextureSampler& sampler)
-{
-	if (m_batch.elements > 0 && sampler != m_batch.sampler)
-		INSERT_BATCH();
+			pass.mesh = m_quad_meshes[chunk];
+			pass.index_start = (i64)(start - chunk * quad_chunk_elements) * 3;
+			pass.index_count = (i64)(chunk_end - start) * 3;
+			pass.perform();
+			m_stats.draw_calls++;
 
-	m_batch.sampler = sampler;
+			start = chunk_end;
+		}
+	}
 }
 
-void Batch::render(const TargetRef& target)
+void Batch::render_overdraw(const TargetRef& target, const Mat4x4f& matrix)
 {
-	TargetRef ref = (target ? target : App::backbuffer());
-	render(ref, Mat4x4f::create_ortho_offcenter(0, (float)ref->width(), (float)ref->height(), 0, 0.01f, 1000.0f));
-}
+	BLAH_ASSERT_RENDERER();
 
-void Batch::render(const TargetRef& target, const Mat4x4f& matrix)
-{
-	// nothing to draw
-	if ((m_batches.size() <= 0 && m_batch.elements <= 0) || m_indices.size() <= 0)
+	auto renderer = App::Internal::renderer;
+	if (!renderer->overdraw_batcher_shader)
+	{
+		Log::warn("Measuring overdraw isn't supported by the current Renderer");
 		return;
+	}
 
-	// define defaults
-	{
-		if (!m_mesh)
-			m_mesh = Mesh::create();
+	// create the counting target, matching the size of the one we would draw to
+	const TargetRef& ref = (target ? target : App::backbuffer());
+	const int width = ref->width();
+	const int height = ref->height();
 
-		if (!m_default_material)
-		{
-			BLAH_ASSERT_RENDERER();
-			m_default_material = Material::create(App::Internal::renderer->default_batcher_shader);
-		}
+	if (!m_overdraw_target || m_overdraw_target->width() != width || m_overdraw_target->height() != height)
+	{
+		m_overdraw_target = Target::create(width, height, { TextureFormat::R });
+		if (!m_overdraw_target)
+			return;
 	}
 
-	// upload data
-	m_mesh->index_data(IndexFormat::UInt32, m_indices.data(), m_indices.size());
-	m_mesh->vertex_data(format, m_vertices.data(), m_vertices.size());
+	if (!m_overdraw_material)
+		m_overdraw_material = Material::create(renderer->overdraw_batcher_shader);
+	if (!m_overdraw_instanced_material && renderer->overdraw_batcher_instanced_shader)
+		m_overdraw_instanced_material = Material::create(renderer->overdraw_batcher_instanced_shader);
+
+	m_overdraw_target->clear(Color::transparent);
 
 	DrawCall pass;
-	pass.target = target;
+	pass.target = m_overdraw_target;
 	pass.mesh = m_mesh;
 	pass.has_viewport = false;
 	pass.viewport = Rectf();
@@ -299,81 +1449,109 @@ void Batch::render(const TargetRef& target, const Mat4x4f& matrix)
 	pass.depth = Compare::None;
 	pass.cull = Cull::None;
 
-	// render batches
-	for (int i = 0, n = m_batches.size(); i < n; i++)
+	m_overdraw_pass = true;
+	for (auto& it : m_draws)
 	{
-		// remaining elements in the current batch
-		if (m_batch_insert == i && m_batch.elements > 0)
-			render_single_batch(pass, m_batch, matrix);
-
-		// render the batch
-		render_single_batch(pass, m_batches[i], matrix);
+		if (!it.instanced || m_overdraw_instanced_material)
+			render_single_batch(pass, it, matrix);
 	}
+	m_overdraw_pass = false;
 
-	// remaining elements in the current batch
-	if (m_batch_insert == m_batches.size() && m_batch.elements > 0)
-		render_single_batch(pass, m_batch, matrix);
-}
+	// read back the counts
+	m_overdraw_counts.resize(width * height);
+	m_overdraw_target->texture(0)->get_data(m_overdraw_counts.data());
 
-void Batch::render_single_batch(DrawCall& pass, const DrawBatch& b, const Mat4x4f& matrix)
-{
-	// get the material
-	pass.material = b.material;
-	if (!pass.material)
-		pass.material = m_default_material;
-	
-	// assign texture & sampler, fallback to whatever the first one is if the names are different
-	if (pass.material->has_value(texture_uniform))
-		pass.material->set_texture(texture_uniform, b.texture);
-	else
-		pass.material->set_texture(0, b.texture);
+	if (m_overdraw.heatmap.width != width || m_overdraw.heatmap.height != height)
+		m_overdraw.heatmap = Image(width, height);
 
-	if (pass.material->has_value(sampler_uniform))
-		pass.material->set_sampler(sampler_uniform, b.sampler);
-	else
-		pass.material->set_sampler(0, b.sampler);
+	// targets are stored bottom-up when the renderer's origin is the bottom left
+	const bool flip = App::renderer().origin_bottom_left;
+	int lowest = 255;
+	int highest = 0;
+	u64 total = 0;
 
-	// assign the matrix uniform
-	pass.material->set_value(matrix_uniform, matrix);
-	
-	pass.blend = b.blend;
-	pass.has_scissor = b.scissor.w >= 0 && b.scissor.h >= 0;
-	pass.scissor = b.scissor;
-	pass.index_start = (i64)b.offset * 3;
-	pass.index_count = (i64)b.elements * 3;
+	for (int y = 0; y < height; y++)
+	{
+		const u8* row = m_overdraw_counts.data() + (flip ? height - 1 - y : y) * width;
+		Color* pixels = m_overdraw.heatmap.pixels + y * width;
+
+		for (int x = 0; x < width; x++)
+		{
+			lowest = Calc::min(lowest, (int)row[x]);
+			highest = Calc::max(highest, (int)row[x]);
+			total += row[x];
+			pixels[x] = batch_overdraw_color(row[x]);
+		}
+	}
+
+	m_overdraw.min = (float)lowest;
+	m_overdraw.max = (float)highest;
+	m_overdraw.average = (width * height > 0 ? (float)((double)total / (width * height)) : 0.0f);
+}
 
-	pass.perform();
+const Batch::Overdraw& Batch::overdraw() const
+{
+	return m_overdraw;
 }
 
 void Batch::clear()
 {
 	m_matrix = Mat3x2f::identity;
+	m_matrix_kind = MatrixKind::Identity;
 	m_color_mode = ColorMode::Normal;
 	m_tex_mult = 255;
 	m_tex_wash = 0;
+	m_tex_slot = 0;
+	m_cull_rect = Rectf(0, 0, -1, -1);
+	m_cull_dirty = true;
 
 	m_vertices.clear();
 	m_indices.clear();
+	m_instances.clear();
 
 	m_batch.layer = 0;
 	m_batch.elements = 0;
 	m_batch.offset = 0;
 	m_batch.blend = BlendMode::Normal;
-	m_batch.material.reset();
-	m_batch.texture.reset();
+	m_batch.material = 0;
+	m_batch.texture_count = 0;
 	m_batch.sampler = default_sampler;
 	m_batch.scissor.w = m_batch.scissor.h = -1;
+	m_scissor = m_batch.scissor;
 	m_batch.flip_vertically = false;
+	m_batch.instanced = false;
+	m_batch.mask = MaskState();
+	m_batch.opaque = false;
 
 	m_matrix_stack.clear();
 	m_scissor_stack.clear();
+	m_mask_bounds.clear();
+	m_mask_depth = 0;
+	m_mask_overflow = 0;
 	m_blend_stack.clear();
 	m_material_stack.clear();
+	m_material_table.clear();
+	m_material_buckets.clear();
+	m_texture_table.clear();
+	m_texture_buckets.clear();
 	m_color_mode_stack.clear();
 	m_layer_stack.clear();
+	m_opaque_stack.clear();
 	m_batches.clear();
+	m_draws.clear();
+	m_shader_uniforms.clear();
+	m_frozen = false;
+	m_generation++;
+}
+
+const Batch::Stats& Batch::stats() const
+{
+	return m_stats;
+}
 
-	m_batch_insert = 0;
+void Batch::reset_stats()
+{
+	m_stats = Stats();
 }
 
 void Batch::dispose()
@@ -381,17 +1559,39 @@ void Batch::dispose()
 	clear();
 
 	m_vertices.dispose();
+	m_compact_vertices.dispose();
 	m_indices.dispose();
+	m_instances.dispose();
 	m_matrix_stack.dispose();
 	m_scissor_stack.dispose();
+	m_mask_bounds.dispose();
 	m_blend_stack.dispose();
 	m_material_stack.dispose();
+	m_material_table.dispose();
+	m_material_buckets.dispose();
+	m_texture_table.dispose();
+	m_texture_buckets.dispose();
 	m_color_mode_stack.dispose();
 	m_layer_stack.dispose();
+	m_opaque_stack.dispose();
 	m_batches.dispose();
+	m_batch_keys.dispose();
+	m_batch_keys_swap.dispose();
+	m_draws.dispose();
+	m_circle_tables.dispose();
+	m_circle_table_next = 0;
+	m_arc_points.dispose();
 
 	m_default_material.reset();
+	m_default_instanced_material.reset();
+	m_overdraw_material.reset();
+	m_overdraw_instanced_material.reset();
+	m_overdraw_target.reset();
+	m_overdraw_counts.dispose();
+	m_overdraw.heatmap.dispose();
 	m_mesh.reset();
+	m_instance_mesh.reset();
+	m_quad_meshes.dispose();
 }
 
 void Batch::line(const Vec2f& from, const Vec2f& to, float t, Color color)
@@ -432,6 +1632,31 @@ void Batch::line(const Vec2f& from, const Vec2f& to, float t, Color fromColor, C
 		0, 0, 255);
 }
 
+void Batch::capsule(const Vec2f& from, const Vec2f& to, float t, Color color)
+{
+	const auto diff = to - from;
+	const auto length = diff.length();
+
+	if (length <= 0)
+	{
+		circle(from, t / 2, 16, color);
+	}
+	else if (use_sdf_shapes())
+	{
+		push_sdf_quad((from + to) / 2, diff / length, (length + t) / 2, t / 2, t / 2, 0, color);
+	}
+	else
+	{
+		// body, and a half circle on each end made of two quarters
+		const auto angle = diff.angle();
+		line(from, to, t, color);
+		semi_circle(from, angle + Calc::PI * 0.5f, angle + Calc::PI, t / 2, 4, color);
+		semi_circle(from, angle + Calc::PI, angle + Calc::PI * 1.5f, t / 2, 4, color);
+		semi_circle(to, angle - Calc::PI * 0.5f, angle, t / 2, 4, color);
+		semi_circle(to, angle, angle + Calc::PI * 0.5f, t / 2, 4, color);
+	}
+}
+
 void Batch::bezier_line(const Vec2f& from, const Vec2f& b, const Vec2f& to, int steps, float t, Color color)
 {
 	Vec2f prev = from;
@@ -596,6 +1821,10 @@ void Batch::rect_rounded(const Rectf& rect, float rtl, int rtl_steps, float rtr,
 	{
 		this->rect(rect, color);
 	}
+	else if (use_sdf_shapes() && rtl == rtr && rtl == rbr && rtl == rbl)
+	{
+		push_sdf_quad(rect.center(), Vec2f::unit_x, rect.w / 2, rect.h / 2, rtl, 0, color);
+	}
 	else
 	{
 		// get corners
@@ -636,6 +1865,10 @@ void Batch::rect_rounded_line(const Rectf& r, float rtl, int rtl_steps, float rt
 	{
 		rect_line(r, t, color);
 	}
+	else if (use_sdf_shapes() && rtl == rtr && rtl == rbr && rtl == rbl)
+	{
+		push_sdf_quad(r.center(), Vec2f::unit_x, r.w / 2, r.h / 2, rtl, t, color);
+	}
 	else
 	{
 		// rounded corners
@@ -658,12 +1891,15 @@ void Batch::rect_rounded_line(const Rectf& r, float rtl, int rtl_steps, float rt
 
 void Batch::semi_circle(const Vec2f& center, float start_radians, float end_radians, float radius, int steps, Color centerColor, Color edgeColor)
 {
-	Vec2f last = Vec2f::from_angle(start_radians, radius);
-	float add = Calc::angle_diff(start_radians, end_radians);
+	if (steps <= 0)
+		return;
+
+	const auto points = arc_points(start_radians, Calc::angle_diff(start_radians, end_radians), steps);
+	Vec2f last = points[0] * radius;
 
 	for (int i = 1; i <= steps; i++)
 	{
-		Vec2f next = Vec2f::from_angle(start_radians + add * (i / (float)steps), radius);
+		Vec2f next = points[i] * radius;
 		tri(center + last, center + next, center, edgeColor, edgeColor, centerColor);
 		last = next;
 	}
@@ -680,17 +1916,17 @@ void Batch::semi_circle_line(const Vec2f& center, float start_radians, float end
 	{
 		semi_circle(center, start_radians, end_radians, radius, steps, color, color);
 	}
-	else
+	else if (steps > 0)
 	{
-		const auto add = Calc::angle_diff(start_radians, end_radians);
+		const auto points = arc_points(start_radians, Calc::angle_diff(start_radians, end_radians), steps);
 
-		Vec2f last_inner = Vec2f::from_angle(start_radians, radius - t);
-		Vec2f last_outer = Vec2f::from_angle(start_radians, radius);
+		Vec2f last_inner = points[0] * (radius - t);
+		Vec2f last_outer = points[0] * radius;
 
 		for (int i = 1; i <= steps; i++)
 		{
-			const auto next_inner = Vec2f::from_angle(start_radians + add * (i / (float)steps), radius - t);
-			const auto next_outer = Vec2f::from_angle(start_radians + add * (i / (float)steps), radius);
+			const auto next_inner = points[i] * (radius - t);
+			const auto next_outer = points[i] * radius;
 
 			quad(center + last_inner, center + last_outer, center + next_outer, center + next_inner, color);
 
@@ -707,12 +1943,21 @@ void Batch::circle(const Vec2f& center, float radius, int steps, Color color)
 
 void Batch::circle(const Vec2f& center, float radius, int steps, Color center_color, Color outer_color)
 {
+	if (use_sdf_shapes() && center_color == outer_color)
+	{
+		push_sdf_quad(center, Vec2f::unit_x, radius, radius, radius, 0, center_color);
+		return;
+	}
+
+	if (steps <= 0)
+		return;
+
+	const auto normals = circle_table(steps);
 	Vec2f last = Vec2f(center.x + radius, center.y);
 
 	for (int i = 1; i <= steps; i++)
 	{
-		const auto radians = (i / (float)steps) * Calc::TAU;
-		const auto next = Vec2f(center.x + Calc::cos(radians) * radius, center.y + Calc::sin(radians) * radius);
+		const auto next = Vec2f(center.x + normals[i].x * radius, center.y + normals[i].y * radius);
 
 		tri(last, next, center, outer_color, outer_color, center_color);
 
@@ -722,19 +1967,25 @@ void Batch::circle(const Vec2f& center, float radius, int steps, Color center_co
 
 void Batch::circle_line(const Vec2f& center, float radius, float t, int steps, Color color)
 {
+	if (use_sdf_shapes())
+	{
+		push_sdf_quad(center, Vec2f::unit_x, radius, radius, radius, Calc::min(t, radius), color);
+		return;
+	}
+
 	if (t >= radius)
 	{
 		circle(center, radius, steps, color);
 	}
-	else
+	else if (steps > 0)
 	{
+		const auto normals = circle_table(steps);
 		Vec2f last_inner = Vec2f(center.x + radius - t, center.y);
 		Vec2f last_outer = Vec2f(center.x + radius, center.y);
 
 		for (int i = 1; i <= steps; i++)
 		{
-			const auto radians = (i / (float)steps) * Calc::TAU;
-			const auto normal = Vec2f(Calc::cos(radians), Calc::sin(radians));
+			const auto& normal = normals[i];
 
 			const auto next_inner = Vec2f(center.x + normal.x * (radius - t), center.y + normal.y * (radius - t));
 			const auto next_outer = Vec2f(center.x + normal.x * radius, center.y + normal.y * radius);
@@ -747,6 +1998,76 @@ void Batch::circle_line(const Vec2f& center, float radius, float t, int steps, C
 	}
 }
 
+const Vec2f* Batch::circle_table(int steps)
+{
+	for (auto& it : m_circle_tables)
+		if (it.steps == steps)
+			return it.points.data();
+
+	// callers can ask for any number of steps, so only the most recent tables are kept
+	CircleTable* table;
+	if (m_circle_tables.size() < max_circle_tables)
+		table = m_circle_tables.expand();
+	else
+	{
+		table = &m_circle_tables[m_circle_table_next];
+		table->points.clear();
+		m_circle_table_next = (m_circle_table_next + 1) % max_circle_tables;
+	}
+	table->steps = steps;
+
+	auto points = table->points.expand(steps + 1);
+	for (int i = 0; i < steps; i++)
+	{
+		const auto radians = (i / (float)steps) * Calc::TAU;
+		points[i] = Vec2f(Calc::cos(radians), Calc::sin(radians));
+	}
+
+	// close the circle exactly
+	points[steps] = points[0];
+
+	return points;
+}
+
+const Vec2f* Batch::arc_points(float start_radians, float add, int steps)
+{
+	m_arc_points.clear();
+	auto points = m_arc_points.expand(steps + 1);
+
+	const auto quarter = Calc::TAU / 4;
+	const auto start_quarters = start_radians / quarter;
+	const auto start_index = (int)Calc::round(start_quarters);
+
+	// quarter arcs that start on an axis (ex. rounded rectangle corners) are part of the circle table with 4x the steps
+	if (Calc::abs(start_quarters - start_index) < 0.0001f && Calc::abs(Calc::abs(add) - quarter) < 0.0001f)
+	{
+		const auto count = steps * 4;
+		const auto table = circle_table(count);
+		const auto dir = (add > 0 ? 1 : count - 1);
+
+		for (int i = 0, index = (((start_index % 4) + 4) % 4) * steps; i <= steps; i++, index = (index + dir) % count)
+			points[i] = table[index];
+	}
+	// otherwise rotate the first point by a fixed step, instead of calculating every angle
+	else
+	{
+		const auto c = Calc::cos(add / steps);
+		const auto s = Calc::sin(add / steps);
+
+		Vec2f at = Vec2f(Calc::cos(start_radians), Calc::sin(start_radians));
+		for (int i = 0; i < steps; i++)
+		{
+			points[i] = at;
+			at = Vec2f(at.x * c - at.y * s, at.x * s + at.y * c);
+		}
+
+		// end exactly on the last angle, so neighbouring shapes line up
+		points[steps] = Vec2f(Calc::cos(start_radians + add), Calc::sin(start_radians + add));
+	}
+
+	return points;
+}
+
 void Batch::quad(const Vec2f& pos0, const Vec2f& pos1, const Vec2f& pos2, const Vec2f& pos3, Color color)
 {
 	PUSH_QUAD(
@@ -825,14 +2146,34 @@ void Batch::arrow_head(const Vec2f& point_pos, const Vec2f& from_pos, float side
 	tri(point_pos, base + perp * side_len / 2, base - perp * side_len / 2, color);
 }
 
-void Batch::tex(const TextureRef& texture, const Vec2f& pos, Color color)
+void Batch::path(const VectorPath& path, Color color)
+{
+	const auto& triangles = path.triangles();
+	const Vec2f* p = triangles.data();
+
+	for (int i = 0, n = triangles.size() - 2; i < n; i += 3, p += 3)
+	{
+		PUSH_TRIANGLE(
+			p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y,
+			0, 0, 0, 0, 0, 0,
+			color, color, color,
+			0, 0, 255);
+	}
+}
+
+void Batch::path(const VectorPath& path, const Vec2f& pos, Color color)
 {
-	set_texture(texture);
+	push_matrix(Mat3x2f::create_translation(pos));
+	this->path(path, color);
+	pop_matrix();
+}
 
+void Batch::tex(const TextureRef& texture, const Vec2f& pos, Color color)
+{
 	const auto w = texture->width();
 	const auto h = texture->height();
 
-	PUSH_QUAD(
+	PUSH_TEXTURED_QUAD(&texture,
 		pos.x, pos.y, pos.x + w, pos.y, pos.x + w, pos.y + h, pos.x, pos.y + h,
 		0, 0, 1, 0, 1, 1, 0, 1,
 		color, color, color, color,
@@ -843,12 +2184,10 @@ void Batch::tex(const TextureRef& texture, const Vec2f& pos, const Vec2f& origin
 {
 	push_matrix(Mat3x2f::create_transform(pos, origin, scale, rotation));
 
-	set_texture(texture);
-
 	const auto w = texture->width();
 	const auto h = texture->height();
 
-	PUSH_QUAD(
+	PUSH_TEXTURED_QUAD(&texture,
 		0, 0, w, 0, w, h, 0, h,
 		0, 0, 1, 0, 1, 1, 0, 1,
 		color, color, color, color,
@@ -861,8 +2200,6 @@ void Batch::tex(const TextureRef& texture, const Rectf& clip, const Vec2f& pos,
 {
 	push_matrix(Mat3x2f::create_transform(pos, origin, scale, rotation));
 
-	set_texture(texture);
-
 	const auto tw = texture->width();
 	const auto th = texture->height();
 	const auto tx0 = clip.x / tw;
@@ -870,7 +2207,7 @@ void Batch::tex(const TextureRef& texture, const Rectf& clip, const Vec2f& pos,
 	const auto ty0 = clip.y / th;
 	const auto ty1 = (clip.y + clip.h) / th;
 
-	PUSH_QUAD(
+	PUSH_TEXTURED_QUAD(&texture,
 		0, 0, clip.w, 0, clip.w, clip.h, 0, clip.h,
 		tx0, ty0, tx1, ty0, tx1, ty1, tx0, ty1,
 		color, color, color, color,
@@ -881,6 +2218,9 @@ void Batch::tex(const TextureRef& texture, const Rectf& clip, const Vec2f& pos,
 
 void Batch::tex(const Subtexture& sub, const Vec2f& pos, Color color)
 {
+	if (instanced_sprites && push_sprite_instance(sub, Mat3x2f::create_translation(pos) * m_matrix, color))
+		return;
+
 	if (!sub.texture)
 	{
 		PUSH_QUAD(
@@ -894,9 +2234,7 @@ void Batch::tex(const Subtexture& sub, const Vec2f& pos, Color color)
 	}
 	else
 	{
-		set_texture(sub.texture);
-
-		PUSH_QUAD(
+		PUSH_TEXTURED_QUAD(&sub.texture,
 			pos.x + sub.draw_coords[0].x, pos.y + sub.draw_coords[0].y,
 			pos.x + sub.draw_coords[1].x, pos.y + sub.draw_coords[1].y,
 			pos.x + sub.draw_coords[2].x, pos.y + sub.draw_coords[2].y,
@@ -912,6 +2250,42 @@ void Batch::tex(const Subtexture& sub, const Vec2f& pos, Color color)
 
 void Batch::tex(const Subtexture& sub, const Vec2f& pos, const Vec2f& origin, const Vec2f& scale, float rotation, Color color)
 {
+	if (instanced_sprites && push_sprite_instance(sub, Mat3x2f::create_transform(pos, origin, scale, rotation) * m_matrix, color))
+		return;
+
+	// without rotation the transform is just a scale and offset, so skip building the matrix
+	if (rotation == 0)
+	{
+		Vec2f p[4];
+		for (int i = 0; i < 4; i++)
+		{
+			p[i].x = pos.x + (sub.draw_coords[i].x - origin.x) * scale.x;
+			p[i].y = pos.y + (sub.draw_coords[i].y - origin.y) * scale.y;
+		}
+
+		if (!sub.texture)
+		{
+			PUSH_QUAD(
+				p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, p[3].x, p[3].y,
+				0, 0, 0, 0, 0, 0, 0, 0,
+				color, color, color, color,
+				0, 0, 255);
+		}
+		else
+		{
+			PUSH_TEXTURED_QUAD(&sub.texture,
+				p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, p[3].x, p[3].y,
+				sub.tex_coords[0].x, sub.tex_coords[0].y,
+				sub.tex_coords[1].x, sub.tex_coords[1].y,
+				sub.tex_coords[2].x, sub.tex_coords[2].y,
+				sub.tex_coords[3].x, sub.tex_coords[3].y,
+				color, color, color, color,
+				m_tex_mult, m_tex_wash, 0);
+		}
+
+		return;
+	}
+
 	push_matrix(Mat3x2f::create_transform(pos, origin, scale, rotation));
 
 	if (!sub.texture)
@@ -927,9 +2301,7 @@ void Batch::tex(const Subtexture& sub, const Vec2f& pos, const Vec2f& origin, co
 	}
 	else
 	{
-		set_texture(sub.texture);
-
-		PUSH_QUAD(
+		PUSH_TEXTURED_QUAD(&sub.texture,
 			sub.draw_coords[0].x, sub.draw_coords[0].y,
 			sub.draw_coords[1].x, sub.draw_coords[1].y,
 			sub.draw_coords[2].x, sub.draw_coords[2].y,
@@ -945,11 +2317,165 @@ void Batch::tex(const Subtexture& sub, const Vec2f& pos, const Vec2f& origin, co
 	pop_matrix();
 }
 
+
 void Batch::tex(const Subtexture& sub, const Rectf& clip, const Vec2f& pos, const Vec2f& origin, const Vec2f& scale, float rotation, Color color)
 {
 	tex(sub.crop(clip), pos, origin, scale, rotation, color);
 }
 
+void Batch::sprites(const Sprite* sprites, int count)
+{
+	if (count <= 0)
+		return;
+
+	if (!instanced_sprites)
+	{
+		m_vertices.reserve(m_vertices.size() + count * 4);
+		if (!quad_indices)
+			m_indices.reserve(m_indices.size() + count * 6);
+	}
+
+	static const Vec2f no_tex_coords[4];
+	BatchSpriteBlock block;
+
+	for (int first = 0; first < count; first += BatchSpriteBlock::size)
+	{
+		const int block_count = Calc::min(BatchSpriteBlock::size, count - first);
+
+		// this is the same as Mat3x2f::create_transform(position, origin, scale, rotation) * m_matrix,
+		// but without building and multiplying the intermediate matrices. Lanes past the end of the
+		// list repeat the last Sprite, so the whole block can be transformed at once.
+		for (int n = 0; n < BatchSpriteBlock::size; n++)
+		{
+			const auto& it = sprites[first + Calc::min(n, block_count - 1)];
+
+			float m11 = it.scale.x, m12 = 0, m21 = 0, m22 = it.scale.y;
+			if (it.rotation != 0)
+			{
+				const auto c = Calc::cos(it.rotation);
+				const auto s = Calc::sin(it.rotation);
+				m11 = it.scale.x * c;
+				m12 = it.scale.x * s;
+				m21 = -it.scale.y * s;
+				m22 = it.scale.y * c;
+			}
+
+			block.m11[n] = m11;
+			block.m12[n] = m12;
+			block.m21[n] = m21;
+			block.m22[n] = m22;
+			block.m31[n] = it.position.x - it.origin.x * m11 - it.origin.y * m21;
+			block.m32[n] = it.position.y - it.origin.x * m12 - it.origin.y * m22;
+
+			for (int i = 0; i < 4; i++)
+			{
+				block.in_x[i][n] = it.subtexture->draw_coords[i].x;
+				block.in_y[i][n] = it.subtexture->draw_coords[i].y;
+			}
+		}
+
+		batch_transform_sprites(block, m_matrix);
+
+		for (int n = 0; n < block_count; n++)
+		{
+			const auto& it = sprites[first + n];
+			const auto& sub = *it.subtexture;
+
+			const auto mat = Mat3x2f(block.m11[n], block.m12[n], block.m21[n], block.m22[n], block.m31[n], block.m32[n]);
+			if (push_sprite_instance(sub, mat, it.color))
+				continue;
+
+			if (m_batch.instanced)
+				set_instanced(false);
+
+			float px[4], py[4];
+			for (int i = 0; i < 4; i++)
+			{
+				px[i] = block.out_x[i][n];
+				py[i] = block.out_y[i][n];
+			}
+
+			if (integerize)
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					px[i] = Calc::floor(px[i]);
+					py[i] = Calc::floor(py[i]);
+				}
+			}
+
+			if (culling && is_culled(px, py, 4))
+			{
+				m_stats.culled_primitives += 2;
+				continue;
+			}
+
+			const Vec2f* tex;
+			u8 mult, wash, fill;
+
+			if (sub.texture)
+			{
+				tex = sub.tex_coords;
+				mult = m_tex_mult;
+				wash = m_tex_wash;
+				fill = 0;
+			}
+			else
+			{
+				tex = no_tex_coords;
+				mult = wash = 0;
+				fill = 255;
+			}
+
+			float uv[8];
+			for (int i = 0; i < 4; i++)
+			{
+				uv[i * 2 + 0] = tex[i].x;
+				uv[i * 2 + 1] = tex[i].y;
+			}
+
+			if (cpu_scissor && !scissor_points(px, py, 4, uv))
+			{
+				m_stats.culled_primitives += 2;
+				continue;
+			}
+
+			if (sub.texture)
+				set_texture(sub.texture);
+
+			if (!quad_indices)
+			{
+				const auto start = (u32)m_vertices.size();
+				auto _i = m_indices.expand(6);
+				*_i++ = start + 0;
+				*_i++ = start + 1;
+				*_i++ = start + 2;
+				*_i++ = start + 0;
+				*_i++ = start + 2;
+				*_i++ = start + 3;
+			}
+
+			Vertex* _v = m_vertices.expand(4);
+			for (int i = 0; i < 4; i++, _v++)
+			{
+				_v->pos.x = px[i];
+				_v->pos.y = py[i];
+				_v->tex.x = uv[i * 2 + 0];
+				_v->tex.y = m_batch.flip_vertically ? 1.0f - uv[i * 2 + 1] : uv[i * 2 + 1];
+				_v->col = it.color;
+				_v->mult = mult;
+				_v->wash = wash;
+				_v->fill = fill;
+				_v->pad = m_tex_slot;
+			}
+
+			m_stats.emitted_primitives += 2;
+			m_batch.elements += 2;
+			m_generation++;
+		}
+	}
+}
+
 void Batch::str(const SpriteFont& font, const String& text, const Vec2f& pos, Color color)
 {
 	str(font, text, pos, Vec2f::zero, font.size, color);
@@ -962,42 +2488,43 @@ void Batch::str(const SpriteFont& font, const String& text, const Vec2f& pos, co
 		Mat3x2f::create_translation(pos)
 	);
 
-	Vec2f offset = Vec2f(0, font.ascent + font.descent);
-	if (justify.x != 0)
-		offset.x -= font.width_of_line(text) * justify.x;
-	if (justify.y != 0)
-		offset.y -= font.height_of(text) * justify.y;
-
-	u32 last = 0;
-	for (int i = 0, l = text.length(); i < l; i += text.utf8_length(i))
+	font.layout(text, justify, [&](const SpriteFont::Character& ch, const Vec2f& at)
 	{
-		u32 next = text.utf8_at(i);
-
-		if (next == '\n')
-		{
-			offset.x = 0;
-			offset.y += font.line_height();
+		tex(ch.subtexture, at, color);
+	});
 
-			if (justify.x != 0)
-				offset.x -= font.width_of_line(text, i + 1) * justify.x;
+	pop_matrix();
+}
 
-			last = 0;
-			continue;
-		}
+void Batch::str(const TextLayout& layout, const Vec2f& pos, Color color)
+{
+	str(layout, pos, layout.font_size(), color);
+}
 
-		const auto& ch = font[next];
-		if (ch.subtexture.texture)
-		{
-			Vec2f at = offset + ch.offset;
+void Batch::str(const TextLayout& layout, const Vec2f& pos, float size, Color color)
+{
+	if (layout.font_size() <= 0 || layout.glyphs().size() <= 0)
+		return;
 
-			if (i > 0 && text[i - 1] != '\n')
-				at.x += font.get_kerning(last, next);
+	push_matrix(
+		Mat3x2f::create_scale(size / layout.font_size()) *
+		Mat3x2f::create_translation(pos)
+	);
 
-			tex(ch.subtexture, at, color);
+	const auto glyphs = layout.glyphs().data();
+	for (auto& run : layout.runs())
+	{
+		for (int i = run.start, end = run.start + run.count; i < end; i++)
+		{
+			const auto& draw = glyphs[i].draw_coords;
+			const auto& tex = glyphs[i].tex_coords;
+
+			PUSH_TEXTURED_QUAD(&run.texture,
+				draw[0].x, draw[0].y, draw[1].x, draw[1].y, draw[2].x, draw[2].y, draw[3].x, draw[3].y,
+				tex[0].x, tex[0].y, tex[1].x, tex[1].y, tex[2].x, tex[2].y, tex[3].x, tex[3].y,
+				color, color, color, color,
+				m_tex_mult, m_tex_wash, 0);
 		}
-
-		offset.x += ch.advance;
-		last = next;
 	}
 
 	pop_matrix();
@@ -0,0 +1,57 @@
+#include <blah/drawing/textlayout.h>
+
+using namespace Blah;
+
+TextLayout::TextLayout(const SpriteFont& font, const String& text, const Vec2f& justify)
+{
+	set(font, text, justify);
+}
+
+void TextLayout::set(const SpriteFont& font, const String& text, const Vec2f& justify)
+{
+	// already laid out
+	if (m_font == &font && m_font_size == font.size && m_justify == justify && m_text == text)
+		return;
+
+	m_font = &font;
+	m_font_size = font.size;
+	m_text = text;
+	m_justify = justify;
+	m_glyphs.clear();
+	m_runs.clear();
+
+	font.layout(text, justify, [this](const SpriteFont::Character& ch, const Vec2f& at)
+	{
+		// start a new run when the texture changes
+		if (m_runs.size() <= 0 || m_runs.back().texture != ch.subtexture.texture)
+		{
+			auto run = m_runs.expand();
+			run->texture = ch.subtexture.texture;
+			run->start = m_glyphs.size();
+		}
+
+		auto glyph = m_glyphs.expand();
+		for (int n = 0; n < 4; n++)
+		{
+			glyph->draw_coords[n] = at + ch.subtexture.draw_coords[n];
+			glyph->tex_coords[n] = ch.subtexture.tex_coords[n];
+		}
+
+		m_runs.back().count++;
+	});
+}
+
+void TextLayout::invalidate()
+{
+	m_font = nullptr;
+}
+
+void TextLayout::clear()
+{
+	m_font = nullptr;
+	m_font_size = 0;
+	m_text.clear();
+	m_justify = Vec2f::zero;
+	m_glyphs.clear();
+	m_runs.clear();
+}
@@ -0,0 +1,297 @@
+#include <blah/drawing/vectorpath.h>
+#include <blah/math/calc.h>
+
+using namespace Blah;
+
+namespace
+{
+	float path_cross(const Vec2f& a, const Vec2f& b)
+	{
+		return a.x * b.y - a.y * b.x;
+	}
+
+	// left hand normal of the line from a to b, or zero if they're the same point
+	Vec2f path_normal(const Vec2f& a, const Vec2f& b)
+	{
+		const Vec2f d = b - a;
+		const float length = d.length();
+		if (length <= 0)
+			return Vec2f::zero;
+		return Vec2f(-d.y / length, d.x / length);
+	}
+}
+
+void VectorPath::move_to(const Vec2f& point)
+{
+	auto sub = m_sub_paths.expand();
+	sub->start = m_points.size();
+	sub->count = 1;
+	m_points.push_back(point);
+}
+
+void VectorPath::line_to(const Vec2f& point)
+{
+	if (m_sub_paths.size() <= 0 || m_sub_paths.back().closed)
+	{
+		move_to(point);
+		return;
+	}
+
+	m_points.push_back(point);
+	m_sub_paths.back().count++;
+}
+
+void VectorPath::quad_to(const Vec2f& b, const Vec2f& to, int steps)
+{
+	const Vec2f from = (m_points.size() > 0 ? m_points.back() : Vec2f::zero);
+	const float add = 1.0f / Calc::max(1, steps);
+
+	for (int i = 1; i < steps; i++)
+		line_to(Vec2f::lerp_bezier(from, b, to, add * i));
+	line_to(to);
+}
+
+void VectorPath::cubic_to(const Vec2f& b, const Vec2f& c, const Vec2f& to, int steps)
+{
+	const Vec2f from = (m_points.size() > 0 ? m_points.back() : Vec2f::zero);
+	const float add = 1.0f / Calc::max(1, steps);
+
+	for (int i = 1; i < steps; i++)
+		line_to(Vec2f::lerp_bezier(from, b, c, to, add * i));
+	line_to(to);
+}
+
+void VectorPath::close()
+{
+	if (m_sub_paths.size() > 0)
+		m_sub_paths.back().closed = true;
+}
+
+void VectorPath::fill()
+{
+	m_triangles.clear();
+
+	for (auto& sub : m_sub_paths)
+	{
+		int count;
+		const Vec2f* points = polygon(sub, &count);
+		fill_polygon(points, count);
+	}
+}
+
+void VectorPath::stroke(float thickness, Join join, float miter_limit)
+{
+	m_triangles.clear();
+
+	if (thickness <= 0)
+		return;
+
+	for (auto& sub : m_sub_paths)
+	{
+		int count;
+		const Vec2f* points = polygon(sub, &count);
+		stroke_polygon(points, count, sub.closed, thickness * 0.5f, join, miter_limit);
+	}
+}
+
+void VectorPath::clear()
+{
+	m_points.clear();
+	m_sub_paths.clear();
+	m_triangles.clear();
+}
+
+const Vec2f* VectorPath::polygon(const SubPath& sub, int* count)
+{
+	// copy the sub-path, skipping repeated points which would produce degenerate segments
+	m_polygon.clear();
+	for (int i = sub.start, end = sub.start + sub.count; i < end; i++)
+	{
+		if (m_polygon.size() <= 0 || m_polygon.back() != m_points[i])
+			m_polygon.push_back(m_points[i]);
+	}
+
+	if (m_polygon.size() > 1 && m_polygon.back() == m_polygon[0])
+		m_polygon.pop();
+
+	*count = m_polygon.size();
+	return m_polygon.data();
+}
+
+void VectorPath::fill_polygon(const Vec2f* points, int count)
+{
+	if (count < 3)
+		return;
+
+	// find which way the polygon winds, so convex corners can be told apart from reflex ones
+	float area = 0;
+	for (int i = 0; i < count; i++)
+		area += path_cross(points[i], points[(i + 1) % count]);
+	const float winding = (area < 0 ? -1.0f : 1.0f);
+
+	m_indices.clear();
+	for (int i = 0; i < count; i++)
+		m_indices.push_back(i);
+
+	// ear clipping: repeatedly cut off a convex corner whose triangle contains no other point
+	int at = 0;
+	int misses = 0;
+
+	while (m_indices.size() > 3)
+	{
+		const int remaining = m_indices.size();
+		at %= remaining;
+
+		const int ia = m_indices[(at + remaining - 1) % remaining];
+		const int ib = m_indices[at];
+		const int ic = m_indices[(at + 1) % remaining];
+		const Vec2f& a = points[ia];
+		const Vec2f& b = points[ib];
+		const Vec2f& c = points[ic];
+
+		bool ear = path_cross(b - a, c - b) * winding > 0;
+
+		for (int n = 0; ear && n < remaining; n++)
+		{
+			const int index = m_indices[n];
+			if (index == ia || index == ib || index == ic)
+				continue;
+
+			const Vec2f& p = points[index];
+			if (p == a || p == b || p == c)
+				continue;
+
+			if (path_cross(b - a, p - a) * winding >= 0 &&
+				path_cross(c - b, p - b) * winding >= 0 &&
+				path_cross(a - c, p - c) * winding >= 0)
+				ear = false;
+		}
+
+		if (ear)
+		{
+			m_triangles.push_back(a);
+			m_triangles.push_back(b);
+			m_triangles.push_back(c);
+			m_indices.erase(at);
+			misses = 0;
+		}
+		else if (++misses > remaining)
+		{
+			// no ears left, which only happens for self-intersecting or degenerate polygons
+			for (int n = 1; n < remaining - 1; n++)
+			{
+				m_triangles.push_back(points[m_indices[0]]);
+				m_triangles.push_back(points[m_indices[n]]);
+				m_triangles.push_back(points[m_indices[n + 1]]);
+			}
+			m_indices.clear();
+		}
+		else
+		{
+			at++;
+		}
+	}
+
+	if (m_indices.size() == 3)
+	{
+		m_triangles.push_back(points[m_indices[0]]);
+		m_triangles.push_back(points[m_indices[1]]);
+		m_triangles.push_back(points[m_indices[2]]);
+	}
+}
+
+void VectorPath::stroke_polygon(const Vec2f* points, int count, bool closed, float half, Join join, float miter_limit)
+{
+	if (count < 2)
+		return;
+
+	const int segments = (closed && count > 2 ? count : count - 1);
+
+	for (int i = 0; i < segments; i++)
+	{
+		const Vec2f& a = points[i];
+		const Vec2f& b = points[(i + 1) % count];
+		const Vec2f n = path_normal(a, b) * half;
+
+		m_triangles.push_back(a + n);
+		m_triangles.push_back(b + n);
+		m_triangles.push_back(b - n);
+		m_triangles.push_back(a + n);
+		m_triangles.push_back(b - n);
+		m_triangles.push_back(a - n);
+	}
+
+	// fill the gaps on the outside of each corner
+	const int first = (segments == count ? 0 : 1);
+	const int last = (segments == count ? count : count - 1);
+
+	for (int i = first; i < last; i++)
+	{
+		const Vec2f& prev = points[(i + count - 1) % count];
+		const Vec2f& at = points[i];
+		const Vec2f& next = points[(i + 1) % count];
+
+		stroke_join(at, path_normal(prev, at), path_normal(at, next), path_cross(at - prev, next - at), half, join, miter_limit);
+	}
+}
+
+void VectorPath::stroke_join(const Vec2f& at, const Vec2f& n0, const Vec2f& n1, float turn, float half, Join join, float miter_limit)
+{
+	// the outside of the corner is opposite to the direction the line turns towards
+	const float side = (turn > 0 ? -1.0f : 1.0f);
+	const Vec2f s0 = n0 * side;
+	const Vec2f s1 = n1 * side;
+	const Vec2f o0 = at + s0 * half;
+	const Vec2f o1 = at + s1 * half;
+
+	if (join == Join::Round)
+	{
+		const float sweep = Calc::atan2(path_cross(s0, s1), Vec2f::dot(s0, s1));
+		if (Calc::abs(sweep) <= 0.0001f)
+			return;
+
+		const int steps = Calc::max(1, (int)Calc::ceiling(Calc::abs(sweep) / Calc::PI * 16));
+
+		Vec2f last = o0;
+		for (int i = 1; i <= steps; i++)
+		{
+			const float angle = sweep * i / steps;
+			const float c = Calc::cos(angle);
+			const float s = Calc::sin(angle);
+			const Vec2f next = (i < steps ? at + Vec2f(s0.x * c - s0.y * s, s0.x * s + s0.y * c) * half : o1);
+
+			m_triangles.push_back(at);
+			m_triangles.push_back(last);
+			m_triangles.push_back(next);
+			last = next;
+		}
+
+		return;
+	}
+
+	// straight lines, or lines that double back on themselves, have nothing to fill
+	const Vec2f bisector = s0 + s1;
+	if (Calc::abs(turn) <= 0 || bisector.length_squared() <= 0.0001f)
+		return;
+
+	const Vec2f dir = bisector.normal();
+	const float length = half / Vec2f::dot(dir, s0);
+
+	if (length <= half * miter_limit)
+	{
+		const Vec2f miter = at + dir * length;
+
+		m_triangles.push_back(at);
+		m_triangles.push_back(o0);
+		m_triangles.push_back(miter);
+		m_triangles.push_back(at);
+		m_triangles.push_back(miter);
+		m_triangles.push_back(o1);
+	}
+	else
+	{
+		m_triangles.push_back(at);
+		m_triangles.push_back(o0);
+		m_triangles.push_back(o1);
+	}
+}
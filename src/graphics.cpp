@@ -3,6 +3,32 @@
 
 using namespace Blah;
 
+namespace
+{
+	// Source of unique Material generations
+	u32 blah_next_material_generation = 0;
+
+	int blah_calc_uniform_size(const UniformInfo& uniform)
+	{
+		int components = 0;
+
+		switch (uniform.type)
+		{
+		case UniformType::Float: components = 1; break;
+		case UniformType::Float2: components = 2; break;
+		case UniformType::Float3: components = 3; break;
+		case UniformType::Float4: components = 4; break;
+		case UniformType::Mat3x2: components = 6; break;
+		case UniformType::Mat4x4: components = 16; break;
+		default:
+			BLAH_ASSERT(false, "Unespected Uniform Type");
+			break;
+		}
+
+		return components * uniform.array_length;
+	}
+}
+
 const BlendMode BlendMode::Normal = BlendMode(
 	BlendOp::Add,
 	BlendFactor::One,
@@ -117,6 +143,55 @@ ShaderRef Shader::create(const ShaderData& data)
 	return shader;
 }
 
+UniformHandle Shader::find(const char* name) const
+{
+	UniformHandle handle;
+	handle.shader = this;
+
+	if (name == nullptr || name[0] == '\0')
+		return handle;
+
+	auto& list = uniforms();
+	int offset = 0;
+
+	for (int i = 0; i < list.size(); i++)
+	{
+		auto& uniform = list[i];
+		bool is_value =
+			uniform.type != UniformType::Texture2D &&
+			uniform.type != UniformType::Sampler2D &&
+			uniform.type != UniformType::None;
+
+		if (strcmp(uniform.name, name) == 0)
+		{
+			// uniforms without a known type have no data or registers to refer to
+			if (uniform.type == UniformType::None)
+				return handle;
+
+			handle.index = i;
+			handle.type = uniform.type;
+
+			if (is_value)
+			{
+				handle.offset = offset;
+				handle.length = blah_calc_uniform_size(uniform);
+			}
+			else
+			{
+				handle.offset = uniform.register_index;
+				handle.length = uniform.array_length;
+			}
+
+			return handle;
+		}
+
+		if (is_value)
+			offset += blah_calc_uniform_size(uniform);
+	}
+
+	return handle;
+}
+
 TextureRef Texture::create(const Image& image)
 {
 	return create(image.width, image.height, TextureFormat::RGBA, (unsigned char*)image.pixels);
@@ -229,28 +304,6 @@ MeshRef Mesh::create()
 }
 
 
-namespace
-{
-	int blah_calc_uniform_size(const UniformInfo& uniform)
-	{
-		int components = 0;
-
-		switch (uniform.type)
-		{
-		case UniformType::Float: components = 1; break;
-		case UniformType::Float2: components = 2; break;
-		case UniformType::Float3: components = 3; break;
-		case UniformType::Float4: components = 4; break;
-		case UniformType::Mat3x2: components = 6; break;
-		case UniformType::Mat4x4: components = 16; break;
-		default:
-			BLAH_ASSERT(false, "Unespected Uniform Type");
-			break;
-		}
-
-		return components * uniform.array_length;
-	}
-}
 
 Material::Material(const ShaderRef& shader)
 {
@@ -283,6 +336,7 @@ Material::Material(const ShaderRef& shader)
 	}
 
 	m_data.expand(float_size);
+	m_generation = ++blah_next_material_generation;
 }
 
 MaterialRef Material::create(const ShaderRef& shader)
@@ -313,20 +367,11 @@ void Material::set_texture(const char* name, const TextureRef& texture, int inde
 {
 	BLAH_ASSERT(m_shader, "Material Shader is invalid");
 
-	for (auto& uniform : m_shader->uniforms())
+	auto uniform = m_shader->find(name);
+	if (uniform.type == UniformType::Texture2D && index >= 0 && index < uniform.length)
 	{
-		if (uniform.type != UniformType::Texture2D)
-			continue;
-
-		if (strcmp(uniform.name, name) == 0)
-		{
-			if (uniform.register_index + index < m_textures.size())
-			{
-				m_textures[uniform.register_index + index] = texture;
-				return;
-			}
-			break;
-		}
+		set_texture(uniform, texture, index);
+		return;
 	}
 
 	Log::warn("No Texture Uniform '%s' at index [%i] exists", name, index);
@@ -342,25 +387,42 @@ void Material::set_texture(int register_index, const TextureRef& texture)
 		return;
 	}
 
-	m_textures[register_index] = texture;
+	if (m_textures[register_index] != texture)
+	{
+		m_textures[register_index] = texture;
+		m_generation = ++blah_next_material_generation;
+	}
 }
 
-TextureRef Material::get_texture(const char* name, int index) const
+void Material::set_texture(const UniformHandle& uniform, const TextureRef& texture, int index)
 {
-	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+	if (uniform.shader != m_shader.get())
+	{
+		Log::warn("Uniform Handle belongs to a different Shader");
+		return;
+	}
 
-	for (auto& uniform : m_shader->uniforms())
+	if (uniform.type != UniformType::Texture2D || index < 0 || index >= uniform.length)
 	{
-		if (uniform.type != UniformType::Texture2D)
-			continue;
+		Log::warn("Invalid Texture Uniform Handle at index [%i]", index);
+		return;
+	}
 
-		if (strcmp(uniform.name, name) == 0)
-		{
-			if (uniform.register_index + index < m_textures.size())
-				return m_textures[uniform.register_index + index];
-			break;
-		}
+	auto& slot = m_textures[uniform.offset + index];
+	if (slot != texture)
+	{
+		slot = texture;
+		m_generation = ++blah_next_material_generation;
 	}
+}
+
+TextureRef Material::get_texture(const char* name, int index) const
+{
+	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+
+	auto uniform = m_shader->find(name);
+	if (uniform.type == UniformType::Texture2D && index >= 0 && index < uniform.length)
+		return get_texture(uniform, index);
 
 	Log::warn("No Texture Uniform '%s' at index [%i] exists", name, index);
 	return TextureRef();
@@ -377,24 +439,32 @@ TextureRef Material::get_texture(int register_index) const
 	return TextureRef();
 }
 
+TextureRef Material::get_texture(const UniformHandle& uniform, int index) const
+{
+	if (uniform.shader != m_shader.get())
+	{
+		Log::warn("Uniform Handle belongs to a different Shader");
+		return TextureRef();
+	}
+
+	if (uniform.type != UniformType::Texture2D || index < 0 || index >= uniform.length)
+	{
+		Log::warn("Invalid Texture Uniform Handle at index [%i]", index);
+		return TextureRef();
+	}
+
+	return m_textures[uniform.offset + index];
+}
+
 void Material::set_sampler(const char* name, const TextureSampler& sampler, int index)
 {
 	BLAH_ASSERT(m_shader, "Material Shader is invalid");
 
-	for (auto& uniform : m_shader->uniforms())
+	auto uniform = m_shader->find(name);
+	if (uniform.type == UniformType::Sampler2D && index >= 0 && index < uniform.length)
 	{
-		if (uniform.type != UniformType::Sampler2D)
-			continue;
-
-		if (strcmp(uniform.name, name) == 0)
-		{
-			if (uniform.register_index + index < m_samplers.size())
-			{
-				m_samplers[uniform.register_index + index] = sampler;
-				return;
-			}
-			break;
-		}
+		set_sampler(uniform, sampler, index);
+		return;
 	}
 
 	Log::warn("No Texture Sampler Uniform '%s' at index [%i] exists", name, index);
@@ -410,25 +480,42 @@ void Material::set_sampler(int register_index, const TextureSampler& sampler)
 		return;
 	}
 
-	m_samplers[register_index] = sampler;
+	if (m_samplers[register_index] != sampler)
+	{
+		m_samplers[register_index] = sampler;
+		m_generation = ++blah_next_material_generation;
+	}
 }
 
-TextureSampler Material::get_sampler(const char* name, int index) const
+void Material::set_sampler(const UniformHandle& uniform, const TextureSampler& sampler, int index)
 {
-	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+	if (uniform.shader != m_shader.get())
+	{
+		Log::warn("Uniform Handle belongs to a different Shader");
+		return;
+	}
 
-	for (auto& uniform : m_shader->uniforms())
+	if (uniform.type != UniformType::Sampler2D || index < 0 || index >= uniform.length)
 	{
-		if (uniform.type != UniformType::Sampler2D)
-			continue;
+		Log::warn("Invalid Texture Sampler Uniform Handle at index [%i]", index);
+		return;
+	}
 
-		if (strcmp(uniform.name, name) == 0)
-		{
-			if (uniform.register_index + index < m_samplers.size())
-				return m_samplers[uniform.register_index + index];
-			break;
-		}
+	auto& slot = m_samplers[uniform.offset + index];
+	if (slot != sampler)
+	{
+		slot = sampler;
+		m_generation = ++blah_next_material_generation;
 	}
+}
+
+TextureSampler Material::get_sampler(const char* name, int index) const
+{
+	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+
+	auto uniform = m_shader->find(name);
+	if (uniform.type == UniformType::Sampler2D && index >= 0 && index < uniform.length)
+		return get_sampler(uniform, index);
 
 	Log::warn("No Texture Sampler Uniform '%s' at index [%i] exists", name, index);
 	return TextureSampler();
@@ -445,35 +532,38 @@ TextureSampler Material::get_sampler(int register_index) const
 	return TextureSampler();
 }
 
+TextureSampler Material::get_sampler(const UniformHandle& uniform, int index) const
+{
+	if (uniform.shader != m_shader.get())
+	{
+		Log::warn("Uniform Handle belongs to a different Shader");
+		return TextureSampler();
+	}
+
+	if (uniform.type != UniformType::Sampler2D || index < 0 || index >= uniform.length)
+	{
+		Log::warn("Invalid Texture Sampler Uniform Handle at index [%i]", index);
+		return TextureSampler();
+	}
+
+	return m_samplers[uniform.offset + index];
+}
+
 void Material::set_value(const char* name, const float* value, i64 length)
 {
 	BLAH_ASSERT(m_shader, "Material Shader is invalid");
-	BLAH_ASSERT(length >= 0, "Length must be >= 0");
 
-	int index = 0;
-	int offset = 0;
-	for (auto& uniform : m_shader->uniforms())
+	auto uniform = m_shader->find(name);
+	if (uniform && uniform.type != UniformType::Texture2D && uniform.type != UniformType::Sampler2D && uniform.type != UniformType::None)
 	{
-		if (uniform.type == UniformType::Texture2D ||
-			uniform.type == UniformType::Sampler2D ||
-			uniform.type == UniformType::None)
-			continue;
-
-		if (strcmp(uniform.name, name) == 0)
+		if (length > uniform.length)
 		{
-			auto max = blah_calc_uniform_size(uniform);
-			if (length > max)
-			{
-				Log::warn("Exceeding length of Uniform '%s' (%i / %i)", name, length, max);
-				length = max;
-			}
-
-			memcpy(m_data.begin() + offset, value, sizeof(float) * length);
-			return;
+			Log::warn("Exceeding length of Uniform '%s' (%i / %i)", name, length, uniform.length);
+			length = uniform.length;
 		}
 
-		offset += blah_calc_uniform_size(uniform);
-		index++;
+		set_value(uniform, value, length);
+		return;
 	}
 
 	Log::warn("No Uniform '%s' exists", name);
@@ -539,47 +629,107 @@ void Material::set_value(const char* name, const Vector<Mat4x4f>& value)
 	set_value(name, (float*)value.data(), value.size() * 16);
 }
 
-const float* Material::get_value(const char* name, i64* length) const
+void Material::set_value(const UniformHandle& uniform, const float* value, i64 length)
 {
-	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+	BLAH_ASSERT(length >= 0, "Length must be >= 0");
 
-	int index = 0;
-	int offset = 0;
-	for (auto& uniform : m_shader->uniforms())
+	if (uniform.shader != m_shader.get())
 	{
-		if (uniform.type == UniformType::Texture2D ||
-			uniform.type == UniformType::Sampler2D ||
-			uniform.type == UniformType::None)
-			continue;
+		Log::warn("Uniform Handle belongs to a different Shader");
+		return;
+	}
 
-		if (strcmp(uniform.name, name) == 0)
-		{
-			if (length != nullptr)
-				*length = blah_calc_uniform_size(uniform);
-			return m_data.begin() + offset;
-		}
+	if (!uniform || uniform.type == UniformType::Texture2D || uniform.type == UniformType::Sampler2D || uniform.type == UniformType::None)
+	{
+		Log::warn("Invalid Uniform Handle");
+		return;
+	}
 
-		index++;
-		offset += blah_calc_uniform_size(uniform);
+	if (length <= 0)
+		return;
+
+	if (length > uniform.length)
+		length = uniform.length;
+
+	auto dst = m_data.begin() + uniform.offset;
+	if (memcmp(dst, value, sizeof(float) * length) != 0)
+	{
+		memcpy(dst, value, sizeof(float) * length);
+		m_generation = ++blah_next_material_generation;
 	}
+}
+
+void Material::set_value(const UniformHandle& uniform, float value)
+{
+	set_value(uniform, &value, 1);
+}
+
+void Material::set_value(const UniformHandle& uniform, const Vec2f& value)
+{
+	set_value(uniform, &value.x, 2);
+}
+
+void Material::set_value(const UniformHandle& uniform, const Vec3f& value)
+{
+	set_value(uniform, &value.x, 3);
+}
+
+void Material::set_value(const UniformHandle& uniform, const Vec4f& value)
+{
+	set_value(uniform, &value.x, 4);
+}
+
+void Material::set_value(const UniformHandle& uniform, const Mat3x2f& value)
+{
+	set_value(uniform, &value.m11, 6);
+}
+
+void Material::set_value(const UniformHandle& uniform, const Mat4x4f& value)
+{
+	set_value(uniform, &value.m11, 16);
+}
+
+const float* Material::get_value(const char* name, i64* length) const
+{
+	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+
+	auto uniform = m_shader->find(name);
+	if (uniform && uniform.type != UniformType::Texture2D && uniform.type != UniformType::Sampler2D && uniform.type != UniformType::None)
+		return get_value(uniform, length);
 
 	Log::warn("No Uniform '%s' exists", name);
-	*length = 0;
+	if (length != nullptr)
+		*length = 0;
 	return nullptr;
 }
 
-bool Material::has_value(const char* name) const
+const float* Material::get_value(const UniformHandle& uniform, i64* length) const
 {
-	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+	if (uniform.shader != m_shader.get())
+	{
+		Log::warn("Uniform Handle belongs to a different Shader");
+		if (length != nullptr)
+			*length = 0;
+		return nullptr;
+	}
 
-	if (name != nullptr && name[0] != '\0')
+	if (!uniform || uniform.type == UniformType::Texture2D || uniform.type == UniformType::Sampler2D || uniform.type == UniformType::None)
 	{
-		for (auto& uniform : m_shader->uniforms())
-			if (strcmp(uniform.name, name) == 0)
-				return true;
+		if (length != nullptr)
+			*length = 0;
+		return nullptr;
 	}
 
-	return false;
+	if (length != nullptr)
+		*length = uniform.length;
+	return m_data.begin() + uniform.offset;
+}
+
+bool Material::has_value(const char* name) const
+{
+	BLAH_ASSERT(m_shader, "Material Shader is invalid");
+
+	return (bool)m_shader->find(name);
 }
 
 const Vector<TextureRef>& Material::textures() const
@@ -597,6 +747,11 @@ const float* Material::data() const
 	return m_data.begin();
 }
 
+u32 Material::generation() const
+{
+	return m_generation;
+}
+
 
 DrawCall::DrawCall()
 {
@@ -610,9 +765,17 @@ DrawCall::DrawCall()
 	scissor = Rectf();
 	index_start = 0;
 	index_count = 0;
+	instance_start = 0;
 	instance_count = 0;
 	depth = Compare::None;
 	cull = Cull::None;
+	stencil = Compare::None;
+	stencil_ref = 0;
+	stencil_read_mask = 0xff;
+	stencil_write_mask = 0xff;
+	stencil_fail = StencilOp::Keep;
+	stencil_depth_fail = StencilOp::Keep;
+	stencil_pass = StencilOp::Keep;
 }
 
 void DrawCall::perform()
@@ -653,14 +816,18 @@ void DrawCall::perform()
 
 	// Validate Instance Count
 	i64 instance_count = pass.mesh->instance_count();
-	if (pass.instance_count > instance_count)
+	if (pass.instance_start + pass.instance_count > instance_count)
 	{
 		Log::warn(
-			"Trying to draw more instances than exist in the index buffer (%i / %i); trimming extra instances",
-			pass.instance_count,
+			"Trying to draw more instances than exist in the index buffer (%i-%i / %i); trimming extra instances",
+			pass.instance_start,
+			pass.instance_start + pass.instance_count,
 			instance_count);
 
-		pass.instance_count = instance_count;
+		if (pass.instance_start > instance_count)
+			return;
+
+		pass.instance_count = instance_count - pass.instance_start;
 	}
 
 	// get the total drawable size
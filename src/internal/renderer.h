@@ -12,9 +12,19 @@ namespace Blah
 		// Renderer Info
 		RendererInfo info;
 
+		// Renderer Stats, reset by the App every frame
+		RendererStats stats;
+
 		// Default Shader for the Batcher
 		ShaderRef default_batcher_shader;
 
+		// Default Shader for instanced Batcher sprites (optional)
+		ShaderRef default_batcher_instanced_shader;
+
+		// Shaders that output 1/255 per fragment, for measuring Batcher overdraw (optional)
+		ShaderRef overdraw_batcher_shader;
+		ShaderRef overdraw_batcher_instanced_shader;
+
 		virtual ~Renderer() = default;
 
 		// Initialize the Graphics
@@ -43,8 +43,8 @@ namespace Blah
 		"	float4 mask : MASK;\n"
 		"};\n"
 
-		"Texture2D    u_texture : register(t0);\n"
-		"SamplerState u_texture_sampler : register(s0);\n"
+		"Texture2D    u_texture[8] : register(t0);\n"
+		"SamplerState u_texture_sampler[8] : register(s0);\n"
 
 		"vs_out vs_main(vs_in input)\n"
 		"{\n"
@@ -60,7 +60,31 @@ namespace Blah
 
 		"float4 ps_main(vs_out input) : SV_TARGET\n"
 		"{\n"
-		"	float4 color = u_texture.Sample(u_texture_sampler, input.texcoord);\n"
+		"	int slot = (int)(input.mask.w * 255.0f + 0.5f);\n"
+		"	float2 tex_dx = ddx(input.texcoord);\n"
+		"	float2 tex_dy = ddy(input.texcoord);\n"
+		"	if (slot >= 128)\n"
+		"	{\n"
+		"		float2 size = 0.5f / float2(length(float2(tex_dx.x, tex_dy.x)), length(float2(tex_dx.y, tex_dy.y)));\n"
+		"		float2 half_size = size - 1.0f;\n"
+		"		float2 p = (input.texcoord * 2.0f - 1.0f) * size;\n"
+		"		float m = min(half_size.x, half_size.y);\n"
+		"		float r = input.mask.x * m;\n"
+		"		float2 q = abs(p) - half_size + r;\n"
+		"		float d = length(max(q, 0.0f)) + min(max(q.x, q.y), 0.0f) - r;\n"
+		"		float t = input.mask.y * m;\n"
+		"		if (t > 0.0f) d = abs(d + t * 0.5f) - t * 0.5f;\n"
+		"		return input.color * saturate(0.5f - d);\n"
+		"	}\n"
+		"	float4 color;\n"
+		"	if (slot == 0) color = u_texture[0].Sample(u_texture_sampler[0], input.texcoord);\n"
+		"	else if (slot == 1) color = u_texture[1].Sample(u_texture_sampler[1], input.texcoord);\n"
+		"	else if (slot == 2) color = u_texture[2].Sample(u_texture_sampler[2], input.texcoord);\n"
+		"	else if (slot == 3) color = u_texture[3].Sample(u_texture_sampler[3], input.texcoord);\n"
+		"	else if (slot == 4) color = u_texture[4].Sample(u_texture_sampler[4], input.texcoord);\n"
+		"	else if (slot == 5) color = u_texture[5].Sample(u_texture_sampler[5], input.texcoord);\n"
+		"	else if (slot == 6) color = u_texture[6].Sample(u_texture_sampler[6], input.texcoord);\n"
+		"	else color = u_texture[7].Sample(u_texture_sampler[7], input.texcoord);\n"
 		"	return\n"
 		"		input.mask.x * color * input.color + \n"
 		"		input.mask.y * color.a * input.color + \n"
@@ -78,6 +102,32 @@ namespace Blah
 		}
 	};
 
+	// Counts every shaded fragment, for measuring overdraw with additive blending
+	const char* d3d11_batch_overdraw_fragment_shader = ""
+		"struct vs_out\n"
+		"{\n"
+		"	float4 position : SV_POSITION;\n"
+		"	float2 texcoord : TEX;\n"
+		"	float4 color : COL;\n"
+		"	float4 mask : MASK;\n"
+		"};\n"
+
+		"float4 ps_main(vs_out input) : SV_TARGET\n"
+		"{\n"
+		"	return 1.0f / 255.0f;\n"
+		"}\n";
+
+	const ShaderData d3d11_batch_overdraw_shader_data = {
+		d3d11_batch_shader,
+		d3d11_batch_overdraw_fragment_shader,
+		{
+			{ "POS", 0 },
+			{ "TEX", 0 },
+			{ "COL", 0 },
+			{ "MASK", 0 },
+		}
+	};
+
 	class D3D11_Shader;
 
 	class Renderer_D3D11 : public Renderer
@@ -123,6 +173,12 @@ namespace Blah
 		struct StoredDepthStencil
 		{
 			Compare depth;
+			Compare stencil;
+			u8 stencil_read_mask;
+			u8 stencil_write_mask;
+			StencilOp stencil_fail;
+			StencilOp stencil_depth_fail;
+			StencilOp stencil_pass;
 			ID3D11DepthStencilState* state;
 		};
 
@@ -823,7 +879,7 @@ namespace Blah
 
 		// Store Features
 		info.type = RendererType::D3D11;
-		info.instancing = true;
+		info.instancing = false;
 		info.max_texture_size = D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION;
 		info.origin_bottom_left = false;
 
@@ -853,6 +909,7 @@ namespace Blah
 
 		// create default sprite batch shader
 		default_batcher_shader = Shader::create(d3d11_batch_shader_data);
+		overdraw_batcher_shader = Shader::create(d3d11_batch_overdraw_shader_data);
 
 		return true;
 	}
@@ -991,7 +1048,7 @@ namespace Blah
 			{
 				auto depthstencil = get_depthstencil(pass);
 				if (depthstencil)
-					ctx->OMSetDepthStencilState(depthstencil, 0);
+					ctx->OMSetDepthStencilState(depthstencil, pass.stencil_ref);
 			}
 
 			// Blend Mode
@@ -1607,26 +1664,64 @@ namespace Blah
 	ID3D11DepthStencilState* Renderer_D3D11::get_depthstencil(const DrawCall& pass)
 	{
 		for (auto& it : depthstencil_cache)
-			if (it.depth == pass.depth)
+		{
+			if (it.depth == pass.depth &&
+				it.stencil == pass.stencil &&
+				(pass.stencil == Compare::None || (
+					it.stencil_read_mask == pass.stencil_read_mask &&
+					it.stencil_write_mask == pass.stencil_write_mask &&
+					it.stencil_fail == pass.stencil_fail &&
+					it.stencil_depth_fail == pass.stencil_depth_fail &&
+					it.stencil_pass == pass.stencil_pass)))
 				return it.state;
+		}
+
+		auto get_compare = [](Compare compare)
+		{
+			switch (compare)
+			{
+			case Compare::None: return D3D11_COMPARISON_NEVER;
+			case Compare::Always: return D3D11_COMPARISON_ALWAYS;
+			case Compare::Never: return D3D11_COMPARISON_NEVER;
+			case Compare::Less: return D3D11_COMPARISON_LESS;
+			case Compare::Equal: return D3D11_COMPARISON_EQUAL;
+			case Compare::LessOrEqual: return D3D11_COMPARISON_LESS_EQUAL;
+			case Compare::Greater: return D3D11_COMPARISON_GREATER;
+			case Compare::NotEqual: return D3D11_COMPARISON_NOT_EQUAL;
+			case Compare::GreatorOrEqual: return D3D11_COMPARISON_GREATER_EQUAL;
+			}
+			return D3D11_COMPARISON_NEVER;
+		};
+
+		auto get_stencil_op = [](StencilOp op)
+		{
+			switch (op)
+			{
+			case StencilOp::Keep: return D3D11_STENCIL_OP_KEEP;
+			case StencilOp::Zero: return D3D11_STENCIL_OP_ZERO;
+			case StencilOp::Replace: return D3D11_STENCIL_OP_REPLACE;
+			case StencilOp::Increment: return D3D11_STENCIL_OP_INCR_SAT;
+			case StencilOp::Decrement: return D3D11_STENCIL_OP_DECR_SAT;
+			case StencilOp::Invert: return D3D11_STENCIL_OP_INVERT;
+			case StencilOp::IncrementWrap: return D3D11_STENCIL_OP_INCR;
+			case StencilOp::DecrementWrap: return D3D11_STENCIL_OP_DECR;
+			}
+			return D3D11_STENCIL_OP_KEEP;
+		};
 
 		D3D11_DEPTH_STENCIL_DESC desc = {};
 		desc.DepthEnable = pass.depth != Compare::None;
 		desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-		desc.DepthFunc = D3D11_COMPARISON_NEVER;
-
-		switch (pass.depth)
-		{
-		case Compare::None: desc.DepthFunc = D3D11_COMPARISON_NEVER; break;
-		case Compare::Always: desc.DepthFunc = D3D11_COMPARISON_ALWAYS; break;
-		case Compare::Never: desc.DepthFunc = D3D11_COMPARISON_NEVER; break;
-		case Compare::Less: desc.DepthFunc = D3D11_COMPARISON_LESS; break;
-		case Compare::Equal: desc.DepthFunc = D3D11_COMPARISON_EQUAL; break;
-		case Compare::LessOrEqual: desc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL; break;
-		case Compare::Greater: desc.DepthFunc = D3D11_COMPARISON_GREATER; break;
-		case Compare::NotEqual: desc.DepthFunc = D3D11_COMPARISON_NOT_EQUAL; break;
-		case Compare::GreatorOrEqual: desc.DepthFunc = D3D11_COMPARISON_GREATER_EQUAL; break;
-		}
+		desc.DepthFunc = get_compare(pass.depth);
+
+		desc.StencilEnable = pass.stencil != Compare::None;
+		desc.StencilReadMask = pass.stencil_read_mask;
+		desc.StencilWriteMask = pass.stencil_write_mask;
+		desc.FrontFace.StencilFunc = get_compare(pass.stencil);
+		desc.FrontFace.StencilFailOp = get_stencil_op(pass.stencil_fail);
+		desc.FrontFace.StencilDepthFailOp = get_stencil_op(pass.stencil_depth_fail);
+		desc.FrontFace.StencilPassOp = get_stencil_op(pass.stencil_pass);
+		desc.BackFace = desc.FrontFace;
 
 		ID3D11DepthStencilState* result;
 		auto hr = renderer->device->CreateDepthStencilState(&desc, &result);
@@ -1635,6 +1730,12 @@ namespace Blah
 		{
 			auto entry = depthstencil_cache.expand();
 			entry->depth = pass.depth;
+			entry->stencil = pass.stencil;
+			entry->stencil_read_mask = pass.stencil_read_mask;
+			entry->stencil_write_mask = pass.stencil_write_mask;
+			entry->stencil_fail = pass.stencil_fail;
+			entry->stencil_depth_fail = pass.stencil_depth_fail;
+			entry->stencil_pass = pass.stencil_pass;
 			entry->state = result;
 			return result;
 		}
@@ -171,6 +171,12 @@ typedef char             GLchar;
 #define GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS 0x8B4C
 #define GL_ARRAY_BUFFER 0x8892
 #define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_UNIFORM_BUFFER 0x8A11
+#define GL_MAX_UNIFORM_BUFFER_BINDINGS 0x8A2F
+#define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
 #define GL_STREAM_DRAW 0x88E0
 #define GL_STATIC_DRAW 0x88E4
 #define GL_DYNAMIC_DRAW 0x88E8
@@ -194,6 +200,12 @@ typedef char             GLchar;
 #define GL_FRAGMENT_SHADER 0x8B30
 #define GL_VERTEX_SHADER 0x8B31
 #define GL_ACTIVE_UNIFORMS 0x8B86
+#define GL_ACTIVE_UNIFORM_BLOCKS 0x8A36
+#define GL_UNIFORM_BLOCK_INDEX 0x8A3A
+#define GL_UNIFORM_OFFSET 0x8A3B
+#define GL_UNIFORM_ARRAY_STRIDE 0x8A3C
+#define GL_UNIFORM_MATRIX_STRIDE 0x8A3D
+#define GL_UNIFORM_BLOCK_DATA_SIZE 0x8A40
 #define GL_ACTIVE_ATTRIBUTES 0x8B89
 #define GL_FLOAT_VEC2 0x8B50
 #define GL_FLOAT_VEC3 0x8B51
@@ -237,6 +249,9 @@ typedef char             GLchar;
 	GL_FUNC(ClearStencil, void, GLint stencil) \
 	GL_FUNC(DepthMask, void, GLboolean enabled) \
 	GL_FUNC(DepthFunc, void, GLenum func) \
+	GL_FUNC(StencilFunc, void, GLenum func, GLint ref, GLuint mask) \
+	GL_FUNC(StencilOp, void, GLenum sfail, GLenum dpfail, GLenum dppass) \
+	GL_FUNC(StencilMask, void, GLuint mask) \
 	GL_FUNC(Viewport, void, GLint x, GLint y, GLint width, GLint height) \
 	GL_FUNC(Scissor, void, GLint x, GLint y, GLint width, GLint height) \
 	GL_FUNC(CullFace, void, GLenum mode) \
@@ -258,6 +273,10 @@ typedef char             GLchar;
 	GL_FUNC(FramebufferRenderbuffer, void, GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) \
 	GL_FUNC(FramebufferTexture2D, void, GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) \
 	GL_FUNC(TexParameteri, void, GLenum target, GLenum name, GLint param) \
+	GL_FUNC(GenSamplers, void, GLsizei n, GLuint* samplers) \
+	GL_FUNC(DeleteSamplers, void, GLsizei n, const GLuint* samplers) \
+	GL_FUNC(BindSampler, void, GLuint unit, GLuint sampler) \
+	GL_FUNC(SamplerParameteri, void, GLuint sampler, GLenum name, GLint param) \
 	GL_FUNC(RenderbufferStorage, void, GLenum target, GLenum internalformat, GLint width, GLint height) \
 	GL_FUNC(GetTexImage, void, GLenum target, GLint level, GLenum format, GLenum type, void* data) \
 	GL_FUNC(DrawElements, void, GLenum mode, GLint count, GLenum type, void* indices) \
@@ -271,6 +290,9 @@ typedef char             GLchar;
 	GL_FUNC(BindBuffer, void, GLenum target, GLuint buffer) \
 	GL_FUNC(BufferData, void, GLenum target, GLsizeiptr size, const void* data, GLenum usage) \
 	GL_FUNC(BufferSubData, void, GLenum target, GLintptr offset, GLsizeiptr size, const void* data) \
+	GL_FUNC(BindBufferRange, void, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) \
+	GL_FUNC(MapBufferRange, void*, GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) \
+	GL_FUNC(UnmapBuffer, GLboolean, GLenum target) \
 	GL_FUNC(DeleteBuffers, void, GLint n, GLuint* buffers) \
 	GL_FUNC(DeleteVertexArrays, void, GLint n, GLuint* arrays) \
 	GL_FUNC(EnableVertexAttribArray, void, GLuint location) \
@@ -292,6 +314,10 @@ typedef char             GLchar;
 	GL_FUNC(GetProgramInfoLog, void, GLuint program, GLint maxLength, GLsizei* length, GLchar* infoLog) \
 	GL_FUNC(GetActiveUniform, void, GLuint program, GLuint index, GLint bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name) \
 	GL_FUNC(GetActiveAttrib, void, GLuint program, GLuint index, GLint bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name) \
+	GL_FUNC(GetActiveUniformsiv, void, GLuint program, GLsizei count, const GLuint* indices, GLenum pname, GLint* params) \
+	GL_FUNC(GetActiveUniformBlockiv, void, GLuint program, GLuint index, GLenum pname, GLint* params) \
+	GL_FUNC(GetActiveUniformBlockName, void, GLuint program, GLuint index, GLsizei bufSize, GLsizei* length, GLchar* name) \
+	GL_FUNC(UniformBlockBinding, void, GLuint program, GLuint index, GLuint binding) \
 	GL_FUNC(UseProgram, void, GLuint program) \
 	GL_FUNC(GetUniformLocation, GLint, GLuint program, const GLchar* name) \
 	GL_FUNC(GetAttribLocation, GLint, GLuint program, const GLchar* name) \
@@ -344,6 +370,66 @@ typedef void (APIENTRY* DEBUGPROC)(GLenum source,
 
 namespace Blah
 {
+	const char* opengl_batch_fragment_shader =
+#ifdef __EMSCRIPTEN__
+	"#version 300 es\n"
+	"precision mediump float;\n"
+#else
+	"#version 330\n"
+#endif
+	"uniform sampler2D u_texture[8];\n"
+	"in vec2 v_tex;\n"
+	"in vec4 v_col;\n"
+	"in vec4 v_type;\n"
+	"out vec4 o_color;\n"
+	"void main(void)\n"
+	"{\n"
+	"	int slot = int(v_type.w * 255.0 + 0.5);\n"
+	"	vec2 tex_dx = dFdx(v_tex);\n"
+	"	vec2 tex_dy = dFdy(v_tex);\n"
+	"	if (slot >= 128)\n"
+	"	{\n"
+	"		vec2 size = 0.5 / vec2(length(vec2(tex_dx.x, tex_dy.x)), length(vec2(tex_dx.y, tex_dy.y)));\n"
+	"		vec2 half_size = size - 1.0;\n"
+	"		vec2 p = (v_tex * 2.0 - 1.0) * size;\n"
+	"		float m = min(half_size.x, half_size.y);\n"
+	"		float r = v_type.x * m;\n"
+	"		vec2 q = abs(p) - half_size + r;\n"
+	"		float d = length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - r;\n"
+	"		float t = v_type.y * m;\n"
+	"		if (t > 0.0) d = abs(d + t * 0.5) - t * 0.5;\n"
+	"		o_color = v_col * clamp(0.5 - d, 0.0, 1.0);\n"
+	"		return;\n"
+	"	}\n"
+	"	vec4 color;\n"
+	"	if (slot == 0) color = texture(u_texture[0], v_tex);\n"
+	"	else if (slot == 1) color = texture(u_texture[1], v_tex);\n"
+	"	else if (slot == 2) color = texture(u_texture[2], v_tex);\n"
+	"	else if (slot == 3) color = texture(u_texture[3], v_tex);\n"
+	"	else if (slot == 4) color = texture(u_texture[4], v_tex);\n"
+	"	else if (slot == 5) color = texture(u_texture[5], v_tex);\n"
+	"	else if (slot == 6) color = texture(u_texture[6], v_tex);\n"
+	"	else color = texture(u_texture[7], v_tex);\n"
+	"	o_color = \n"
+	"		v_type.x * color * v_col + \n"
+	"		v_type.y * color.a * v_col + \n"
+	"		v_type.z * v_col;\n"
+	"}";
+
+	// Counts every shaded fragment, for measuring overdraw with additive blending
+	const char* opengl_batch_overdraw_fragment_shader =
+#ifdef __EMSCRIPTEN__
+	"#version 300 es\n"
+	"precision mediump float;\n"
+#else
+	"#version 330\n"
+#endif
+	"out vec4 o_color;\n"
+	"void main(void)\n"
+	"{\n"
+	"	o_color = vec4(1.0 / 255.0);\n"
+	"}";
+
 	const ShaderData opengl_batch_shader_data = {
 		// vertex shader
 #ifdef __EMSCRIPTEN__
@@ -351,7 +437,10 @@ namespace Blah
 #else
 		"#version 330\n"
 #endif
-		"uniform mat4 u_matrix;\n"
+		"layout(std140) uniform BatchMatrix\n"
+		"{\n"
+		"	mat4 u_matrix;\n"
+		"};\n"
 		"layout(location=0) in vec2 a_position;\n"
 		"layout(location=1) in vec2 a_tex;\n"
 		"layout(location=2) in vec4 a_color;\n"
@@ -368,25 +457,42 @@ namespace Blah
 		"}",
 
 		// fragment shader
+		opengl_batch_fragment_shader
+	};
+
+	// Expands per-instance sprite data (origin, axes, uv rect) over a unit quad
+	const ShaderData opengl_batch_instanced_shader_data = {
+		// vertex shader
 #ifdef __EMSCRIPTEN__
 		"#version 300 es\n"
-		"precision mediump float;\n"
 #else
 		"#version 330\n"
 #endif
-		"uniform sampler2D u_texture;\n"
-		"in vec2 v_tex;\n"
-		"in vec4 v_col;\n"
-		"in vec4 v_type;\n"
-		"out vec4 o_color;\n"
+		"layout(std140) uniform BatchMatrix\n"
+		"{\n"
+		"	mat4 u_matrix;\n"
+		"};\n"
+		"layout(location=0) in vec2 a_corner;\n"
+		"layout(location=1) in vec2 a_origin;\n"
+		"layout(location=2) in vec2 a_axis_x;\n"
+		"layout(location=3) in vec2 a_axis_y;\n"
+		"layout(location=4) in vec4 a_tex;\n"
+		"layout(location=5) in vec4 a_color;\n"
+		"layout(location=6) in vec4 a_type;\n"
+		"out vec2 v_tex;\n"
+		"out vec4 v_col;\n"
+		"out vec4 v_type;\n"
 		"void main(void)\n"
 		"{\n"
-		"	vec4 color = texture(u_texture, v_tex);\n"
-		"	o_color = \n"
-		"		v_type.x * color * v_col + \n"
-		"		v_type.y * color.a * v_col + \n"
-		"		v_type.z * v_col;\n"
-		"}"
+		"	vec2 position = a_origin + a_axis_x * a_corner.x + a_axis_y * a_corner.y;\n"
+		"	gl_Position = u_matrix * vec4(position, 0, 1);\n"
+		"	v_tex = mix(a_tex.xy, a_tex.zw, a_corner);\n"
+		"	v_col = a_color;\n"
+		"	v_type = a_type;\n"
+		"}",
+
+		// fragment shader
+		opengl_batch_fragment_shader
 	};
 
 	class Renderer_OpenGL : public Renderer
@@ -401,6 +507,83 @@ namespace Blah
 			#undef GL_FUNC
 		} gl;
 
+		// A cached piece of GL state, unknown until it's first set
+		template<class T>
+		struct Cached
+		{
+			T value;
+			bool known = false;
+		};
+
+		// Stencil values of a DrawCall
+		struct StencilState
+		{
+			Compare func;
+			u8 ref;
+			u8 read_mask;
+			u8 write_mask;
+			StencilOp fail;
+			StencilOp depth_fail;
+			StencilOp pass;
+
+			bool operator==(const StencilState& rhs) const
+			{
+				return
+					func == rhs.func && ref == rhs.ref && read_mask == rhs.read_mask && write_mask == rhs.write_mask &&
+					fail == rhs.fail && depth_fail == rhs.depth_fail && pass == rhs.pass;
+			}
+		};
+
+		// Shadow copy of the GL state, so only state that changed between draws is sent to GL.
+		// Anything that modifies GL state directly must update or forget the matching values.
+		struct State
+		{
+			static constexpr int max_textures = 32;
+
+			Cached<GLuint> framebuffer;
+			Cached<GLuint> program;
+			Cached<GLuint> vertex_array;
+			Cached<GLenum> active_texture;
+			Cached<GLuint> textures[max_textures];
+			Cached<GLuint> samplers[max_textures];
+			Cached<bool> blend_enabled;
+			Cached<BlendMode> blend;
+			Cached<Compare> depth;
+			Cached<StencilState> stencil;
+			Cached<Cull> cull;
+			Cached<Recti> viewport;
+			Cached<bool> scissor_enabled;
+			Cached<Recti> scissor;
+		} state;
+
+		// A uniform block binding point, shared by every program with a block of the same name and size
+		struct UniformBinding
+		{
+			String name;
+			GLint size = 0;
+
+			// The contents last written to the binding, and the Material and generation they came from
+			bool known = false;
+			const Material* material = nullptr;
+			u32 generation = 0;
+			Vector<u8> data;
+		};
+
+		// Uniform blocks are written to consecutive ranges of one buffer, which is orphaned when it fills up
+		static constexpr GLsizeiptr uniform_ring_size = 1 << 20;
+		GLuint uniform_ring;
+		GLintptr uniform_ring_offset;
+		Vector<UniformBinding> uniform_bindings;
+		Vector<u8> uniform_scratch;
+
+		// Sampler objects, created the first time a TextureSampler is used
+		struct SamplerObject
+		{
+			TextureSampler sampler;
+			GLuint id;
+		};
+		Vector<SamplerObject> sampler_objects;
+
 		// state
 		void* context;
 
@@ -412,6 +595,8 @@ namespace Blah
 		int max_samples;
 		int max_texture_image_units;
 		int max_texture_size;
+		int max_uniform_buffer_bindings;
+		int uniform_buffer_alignment;
 
 		bool init() override;
 		void shutdown() override;
@@ -424,6 +609,98 @@ namespace Blah
 		TargetRef create_target(int width, int height, const TextureFormat* attachments, int attachment_count) override;
 		ShaderRef create_shader(const ShaderData* data) override;
 		MeshRef create_mesh() override;
+
+		// Assigns the cached value, returning true if it changed and has to be sent to GL
+		template<class T>
+		bool state_changed(Cached<T>& cached, const T& value)
+		{
+			if (cached.known && cached.value == value)
+			{
+				stats.redundant_state_changes++;
+				return false;
+			}
+
+			cached.value = value;
+			cached.known = true;
+			stats.state_changes++;
+			return true;
+		}
+
+		// Forgets all cached state, so it's all sent to GL on the next draw
+		void invalidate_state()
+		{
+			state = State();
+
+			for (auto& it : uniform_bindings)
+				it.known = false;
+		}
+
+		void bind_framebuffer(GLuint id)
+		{
+			if (state_changed(state.framebuffer, id))
+				gl.BindFramebuffer(GL_FRAMEBUFFER, id);
+		}
+
+		void use_program(GLuint id)
+		{
+			if (state_changed(state.program, id))
+				gl.UseProgram(id);
+		}
+
+		void bind_vertex_array(GLuint id)
+		{
+			if (state_changed(state.vertex_array, id))
+				gl.BindVertexArray(id);
+		}
+
+		void bind_texture(int unit, GLuint id)
+		{
+			if (unit >= State::max_textures)
+			{
+				gl.ActiveTexture(GL_TEXTURE0 + unit);
+				gl.BindTexture(GL_TEXTURE_2D, id);
+				state.active_texture.known = false;
+				return;
+			}
+
+			// the unit is made active even if the texture is already bound to it, since
+			// uploads and readbacks that follow act on the active unit
+			if (state_changed(state.active_texture, (GLenum)(GL_TEXTURE0 + unit)))
+				gl.ActiveTexture(GL_TEXTURE0 + unit);
+			if (state_changed(state.textures[unit], id))
+				gl.BindTexture(GL_TEXTURE_2D, id);
+		}
+
+		void bind_sampler(int unit, GLuint id)
+		{
+			if (unit >= State::max_textures)
+				gl.BindSampler(unit, id);
+			else if (state_changed(state.samplers[unit], id))
+				gl.BindSampler(unit, id);
+		}
+
+		void set_enabled(Cached<bool>& cached, GLenum capability, bool enabled)
+		{
+			if (state_changed(cached, enabled))
+			{
+				if (enabled)
+					gl.Enable(capability);
+				else
+					gl.Disable(capability);
+			}
+		}
+
+		// Finds or creates the sampler object for the given Texture Sampler
+		GLuint get_sampler(const TextureSampler& sampler);
+
+		// Finds or assigns the binding point of a uniform block, or returns -1 if there are none left
+		GLint get_uniform_binding(const char* name, GLint size);
+
+		// Writes the data to the uniform ring buffer, and binds that range to the binding point
+		void write_uniform_binding(GLuint binding, const u8* data, GLint size);
+
+		// Clears the bound framebuffer, used by both Targets and the Backbuffer
+		void clear(GLuint framebuffer, Color color, float depth, u8 stencil, ClearMask mask);
 	};
 
 	// debug callback
@@ -467,7 +744,7 @@ namespace Blah
 	}
 
 	// assign attributes
-	GLuint gl_mesh_assign_attributes(GLuint buffer, GLenum buffer_type, const VertexFormat& format, GLint divisor)
+	GLuint gl_mesh_assign_attributes(GLuint buffer, GLenum buffer_type, const VertexFormat& format, GLint divisor, size_t offset = 0)
 	{
 		// bind
 		renderer->gl.BindBuffer(buffer_type, buffer);
@@ -477,7 +754,7 @@ namespace Blah
 		// ...
 
 		// enable attributes
-		size_t ptr = 0;
+		size_t ptr = offset;
 		for (int n = 0; n < format.attributes.size(); n++)
 		{
 			auto& attribute = format.attributes[n];
@@ -600,13 +877,67 @@ namespace Blah
 		return GL_ZERO;
 	}
 
+	// convert compare function enum
+	GLenum gl_get_compare(Compare compare)
+	{
+		switch (compare)
+		{
+		case Compare::None:				return GL_ALWAYS;
+		case Compare::Always:			return GL_ALWAYS;
+		case Compare::Never:			return GL_NEVER;
+		case Compare::Less:				return GL_LESS;
+		case Compare::Equal:			return GL_EQUAL;
+		case Compare::LessOrEqual:		return GL_LEQUAL;
+		case Compare::Greater:			return GL_GREATER;
+		case Compare::NotEqual:			return GL_NOTEQUAL;
+		case Compare::GreatorOrEqual:	return GL_GEQUAL;
+		};
+
+		return GL_ALWAYS;
+	}
+
+	// convert stencil op enum
+	GLenum gl_get_stencil_op(StencilOp op)
+	{
+		switch (op)
+		{
+		case StencilOp::Keep:			return GL_KEEP;
+		case StencilOp::Zero:			return GL_ZERO;
+		case StencilOp::Replace:		return GL_REPLACE;
+		case StencilOp::Increment:		return GL_INCR;
+		case StencilOp::Decrement:		return GL_DECR;
+		case StencilOp::Invert:			return GL_INVERT;
+		case StencilOp::IncrementWrap:	return GL_INCR_WRAP;
+		case StencilOp::DecrementWrap:	return GL_DECR_WRAP;
+		};
+
+		return GL_KEEP;
+	}
+
+	// Gets the column-major shape of a uniform value, as it's stored in Material data
+	void gl_get_uniform_shape(UniformType type, int* columns, int* rows)
+	{
+		*columns = 1;
+		*rows = 0;
+
+		switch (type)
+		{
+		case UniformType::Float:	*rows = 1; break;
+		case UniformType::Float2:	*rows = 2; break;
+		case UniformType::Float3:	*rows = 3; break;
+		case UniformType::Float4:	*rows = 4; break;
+		case UniformType::Mat3x2:	*columns = 3; *rows = 2; break;
+		case UniformType::Mat4x4:	*columns = 4; *rows = 4; break;
+		default: break;
+		}
+	}
+
 	class OpenGL_Texture : public Texture
 	{
 	private:
 		GLuint m_id;
 		int m_width;
 		int m_height;
-		TextureSampler m_sampler;
 		TextureFormat m_format;
 		GLenum m_gl_internal_format;
 		GLenum m_gl_format;
@@ -620,7 +951,6 @@ namespace Blah
 			m_id = 0;
 			m_width = width;
 			m_height = height;
-			m_sampler = TextureSampler(TextureFilter::None, TextureWrap::None, TextureWrap::None);
 			m_format = format;
 			framebuffer_parent = false;
 			m_gl_internal_format = GL_RED;
@@ -664,15 +994,21 @@ namespace Blah
 			}
 
 			renderer->gl.GenTextures(1, &m_id);
-			renderer->gl.ActiveTexture(GL_TEXTURE0);
-			renderer->gl.BindTexture(GL_TEXTURE_2D, m_id);
+			renderer->bind_texture(0, m_id);
 			renderer->gl.TexImage2D(GL_TEXTURE_2D, 0, m_gl_internal_format, width, height, 0, m_gl_format, m_gl_type, nullptr);
 		}
 
 		~OpenGL_Texture()
 		{
 			if (m_id > 0 && renderer)
+			{
+				// deleting a texture unbinds it
+				for (auto& it : renderer->state.textures)
+					if (it.known && it.value == m_id)
+						it.value = 0;
+
 				renderer->gl.DeleteTextures(1, &m_id);
+			}
 		}
 
 		GLuint gl_id() const
@@ -695,31 +1031,15 @@ namespace Blah
 			return m_format;
 		}
 
-		void update_sampler(const TextureSampler& sampler)
-		{
-			if (m_sampler != sampler)
-			{
-				m_sampler = sampler;
-
-				renderer->gl.BindTexture(GL_TEXTURE_2D, m_id);
-				renderer->gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (m_sampler.filter == TextureFilter::Nearest ? GL_NEAREST : GL_LINEAR));
-				renderer->gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (m_sampler.filter == TextureFilter::Nearest ? GL_NEAREST : GL_LINEAR));
-				renderer->gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (m_sampler.wrap_x == TextureWrap::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT));
-				renderer->gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (m_sampler.wrap_y == TextureWrap::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT));
-			}
-		}
-
 		virtual void set_data(const u8* data) override
 		{
-			renderer->gl.ActiveTexture(GL_TEXTURE0);
-			renderer->gl.BindTexture(GL_TEXTURE_2D, m_id);
+			renderer->bind_texture(0, m_id);
 			renderer->gl.TexImage2D(GL_TEXTURE_2D, 0, m_gl_internal_format, m_width, m_height, 0, m_gl_format, m_gl_type, data);
 		}
 
 		virtual void get_data(u8* data) override
 		{
-			renderer->gl.ActiveTexture(GL_TEXTURE0);
-			renderer->gl.BindTexture(GL_TEXTURE_2D, m_id);
+			renderer->bind_texture(0, m_id);
 			renderer->gl.GetTexImage(GL_TEXTURE_2D, 0, m_gl_internal_format, m_gl_type, data);
 		}
 
@@ -746,7 +1066,7 @@ namespace Blah
 			m_width = width;
 			m_height = height;
 
-			renderer->gl.BindFramebuffer(GL_FRAMEBUFFER, m_id);
+			renderer->bind_framebuffer(m_id);
 
 			for (int i = 0; i < attachmentCount; i++)
 			{
@@ -771,6 +1091,10 @@ namespace Blah
 		{
 			if (m_id > 0 && renderer)
 			{
+				// deleting the bound framebuffer binds the default one
+				if (renderer->state.framebuffer.known && renderer->state.framebuffer.value == m_id)
+					renderer->state.framebuffer.value = 0;
+
 				renderer->gl.DeleteFramebuffers(1, &m_id);
 				m_id = 0;
 			}
@@ -793,33 +1117,7 @@ namespace Blah
 
 		virtual void clear(Color color, float depth, u8 stencil, ClearMask mask) override
 		{
-			renderer->gl.BindFramebuffer(GL_FRAMEBUFFER, m_id);
-			renderer->gl.Disable(GL_SCISSOR_TEST);
-
-			int clear = 0;
-
-			if (((int)mask & (int)ClearMask::Color) == (int)ClearMask::Color)
-			{
-				clear |= GL_COLOR_BUFFER_BIT;
-				renderer->gl.ColorMask(true, true, true, true);
-				renderer->gl.ClearColor(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f);
-			}
-			
-			if (((int)mask & (int)ClearMask::Depth) == (int)ClearMask::Depth)
-			{
-				clear |= GL_DEPTH_BUFFER_BIT;
-				if (renderer->gl.ClearDepth)
-					renderer->gl.ClearDepth(depth);
-			}
-
-			if (((int)mask & (int)ClearMask::Stencil) == (int)ClearMask::Stencil)
-			{
-				clear |= GL_STENCIL_BUFFER_BIT;
-				if (renderer->gl.ClearStencil)
-					renderer->gl.ClearStencil(stencil);
-			}
-
-			renderer->gl.Clear(clear);
+			renderer->clear(m_id, color, depth, stencil, mask);
 		}
 	};
 
@@ -830,7 +1128,29 @@ namespace Blah
 		Vector<UniformInfo> m_uniforms;
 
 	public:
+		// Where a uniform is stored in its uniform block. Loose uniforms have a block of -1.
+		struct BlockMember
+		{
+			GLint block = -1;
+			GLint offset = 0;
+			GLint array_stride = 0;
+			GLint matrix_stride = 0;
+		};
+
+		// A uniform block, and the binding point it was assigned
+		struct Block
+		{
+			GLint binding;
+			GLint size;
+		};
+
 		Vector<GLint> uniform_locations;
+		Vector<BlockMember> uniform_members;
+		Vector<Block> uniform_blocks;
+
+		// The Material and generation whose values were last uploaded to this program
+		const Material* uploaded_material = nullptr;
+		u32 uploaded_generation = 0;
 
 		OpenGL_Shader(const ShaderData* data)
 		{
@@ -918,6 +1238,20 @@ namespace Blah
 					renderer->gl.GetActiveUniform(id, i, max_name_length, &length, &size, &type, name);
 					name[length] = '\0';
 
+					// find where the uniform lives, if it's part of a uniform block
+					BlockMember member;
+					{
+						GLuint index = (GLuint)i;
+						renderer->gl.GetActiveUniformsiv(id, 1, &index, GL_UNIFORM_BLOCK_INDEX, &member.block);
+
+						if (member.block >= 0)
+						{
+							renderer->gl.GetActiveUniformsiv(id, 1, &index, GL_UNIFORM_OFFSET, &member.offset);
+							renderer->gl.GetActiveUniformsiv(id, 1, &index, GL_UNIFORM_ARRAY_STRIDE, &member.array_stride);
+							renderer->gl.GetActiveUniformsiv(id, 1, &index, GL_UNIFORM_MATRIX_STRIDE, &member.matrix_stride);
+						}
+					}
+
 					// array names end with "[0]", and we don't want that
 					for (int n = 0; n < max_name_length; n++)
 						if (name[n] == '[')
@@ -939,6 +1273,7 @@ namespace Blah
 						tex_uniform.type = UniformType::Texture2D;
 						tex_uniform.shader = ShaderType::Fragment;
 						uniform_locations.push_back(renderer->gl.GetUniformLocation(id, name));
+						uniform_members.push_back(BlockMember());
 						m_uniforms.push_back(tex_uniform);
 
 						UniformInfo sampler_uniform;
@@ -949,6 +1284,7 @@ namespace Blah
 						sampler_uniform.type = UniformType::Sampler2D;
 						sampler_uniform.shader = ShaderType::Fragment;
 						uniform_locations.push_back(renderer->gl.GetUniformLocation(id, name));
+						uniform_members.push_back(BlockMember());
 						m_uniforms.push_back(sampler_uniform);
 
 						sampler_uniforms += size;
@@ -959,9 +1295,10 @@ namespace Blah
 						uniform.name = name;
 						uniform.type = UniformType::None;
 						uniform.register_index = 0;
-						uniform.buffer_index = 0;
+						uniform.buffer_index = (member.block >= 0 ? member.block : 0);
 						uniform.array_length = size;
 						uniform_locations.push_back(renderer->gl.GetUniformLocation(id, name));
+						uniform_members.push_back(member);
 						uniform.shader = (ShaderType)((int)ShaderType::Vertex | (int)ShaderType::Fragment);
 
 						if (type == GL_FLOAT)
@@ -987,6 +1324,31 @@ namespace Blah
 					}
 
 				}
+
+				// assign binding points to the uniform blocks
+				GLint active_blocks = 0;
+				renderer->gl.GetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCKS, &active_blocks);
+
+				for (int i = 0; valid_uniforms && i < active_blocks; i++)
+				{
+					GLsizei length;
+					GLchar name[max_name_length + 1] = { 0 };
+					renderer->gl.GetActiveUniformBlockName(id, i, max_name_length, &length, name);
+					name[length] = '\0';
+
+					Block block;
+					renderer->gl.GetActiveUniformBlockiv(id, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+					block.binding = renderer->get_uniform_binding(name, block.size);
+
+					if (block.binding < 0)
+					{
+						valid_uniforms = false;
+						break;
+					}
+
+					renderer->gl.UniformBlockBinding(id, i, block.binding);
+					uniform_blocks.push_back(block);
+				}
 			}
 
 			// assign ID if the uniforms were valid
@@ -999,7 +1361,12 @@ namespace Blah
 		~OpenGL_Shader()
 		{
 			if (m_id > 0 && renderer)
+			{
+				if (renderer->state.program.known && renderer->state.program.value == m_id)
+					renderer->state.program.known = false;
+
 				renderer->gl.DeleteProgram(m_id);
+			}
 			m_id = 0;
 		}
 
@@ -1029,6 +1396,8 @@ namespace Blah
 		i64 m_index_count;
 		i64 m_vertex_count;
 		i64 m_instance_count;
+		i64 m_instance_start;
+		VertexFormat m_instance_format;
 		u16 m_vertex_size;
 		u16 m_instance_size;
 		u8 m_vertex_attribs_enabled;
@@ -1049,6 +1418,7 @@ namespace Blah
 			m_index_count = 0;
 			m_vertex_count = 0;
 			m_instance_count = 0;
+			m_instance_start = 0;
 			m_vertex_size = 0;
 			m_instance_size = 0;
 			m_vertex_attribs_enabled = 0;
@@ -1068,7 +1438,13 @@ namespace Blah
 				if (m_instance_buffer != 0)
 					renderer->gl.DeleteBuffers(1, &m_instance_buffer);
 				if (m_id != 0)
+				{
+					// deleting the bound vertex array binds the default one
+					if (renderer->state.vertex_array.known && renderer->state.vertex_array.value == m_id)
+						renderer->state.vertex_array.value = 0;
+
 					renderer->gl.DeleteVertexArrays(1, &m_id);
+				}
 			}
 			m_id = 0;
 		}
@@ -1088,11 +1464,23 @@ namespace Blah
 			return m_index_size;
 		}
 
+		// Points the instance attributes at the given first instance.
+		// There is no base instance draw in GL 3.3, so this is how instance ranges are drawn.
+		// Expects the Mesh's vertex array to be bound.
+		void gl_set_instance_start(i64 start)
+		{
+			if (m_instance_start != start)
+			{
+				gl_mesh_assign_attributes(m_instance_buffer, GL_ARRAY_BUFFER, m_instance_format, 1, (size_t)(start * m_instance_size));
+				m_instance_start = start;
+			}
+		}
+
 		virtual void index_data(IndexFormat format, const void* indices, i64 count) override
 		{
 			m_index_count = count;
 
-			renderer->gl.BindVertexArray(m_id);
+			renderer->bind_vertex_array(m_id);
 			{
 				if (m_index_buffer == 0)
 					renderer->gl.GenBuffers(1, &(m_index_buffer));
@@ -1112,14 +1500,13 @@ namespace Blah
 				renderer->gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
 				renderer->gl.BufferData(GL_ELEMENT_ARRAY_BUFFER, m_index_size * count, indices, GL_DYNAMIC_DRAW);
 			}
-			renderer->gl.BindVertexArray(0);
 		}
 
 		virtual void vertex_data(const VertexFormat& format, const void* vertices, i64 count) override
 		{
 			m_vertex_count = count;
 
-			renderer->gl.BindVertexArray(m_id);
+			renderer->bind_vertex_array(m_id);
 			{
 				// Create Buffer if it doesn't exist yet
 				if (m_vertex_buffer == 0)
@@ -1133,14 +1520,15 @@ namespace Blah
 				renderer->gl.BindBuffer(GL_ARRAY_BUFFER, m_vertex_buffer);
 				renderer->gl.BufferData(GL_ARRAY_BUFFER, m_vertex_size * count, vertices, GL_DYNAMIC_DRAW);
 			}
-			renderer->gl.BindVertexArray(0);
 		}
 
 		virtual void instance_data(const VertexFormat& format, const void* instances, i64 count) override
 		{
 			m_instance_count = count;
+			m_instance_start = 0;
+			m_instance_format = format;
 
-			renderer->gl.BindVertexArray(m_id);
+			renderer->bind_vertex_array(m_id);
 			{
 				// Create Buffer if it doesn't exist yet
 				if (m_instance_buffer == 0)
@@ -1154,7 +1542,6 @@ namespace Blah
 				renderer->gl.BindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
 				renderer->gl.BufferData(GL_ARRAY_BUFFER, m_instance_size * count, instances, GL_DYNAMIC_DRAW);
 			}
-			renderer->gl.BindVertexArray(0);
 		}
 
 		virtual i64 index_count() const override
@@ -1205,6 +1592,8 @@ namespace Blah
 		gl.GetIntegerv(0x8D57, &max_samples);
 		gl.GetIntegerv(0x8872, &max_texture_image_units);
 		gl.GetIntegerv(0x0D33, &max_texture_size);
+		gl.GetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &max_uniform_buffer_bindings);
+		gl.GetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_buffer_alignment);
 
 		// log
 		Log::info("OpenGL %s, %s",
@@ -1221,20 +1610,50 @@ namespace Blah
 		info.origin_bottom_left = true;
 		info.max_texture_size = max_texture_size;
 
+		// create the uniform block ring buffer
+		uniform_ring_offset = 0;
+		gl.GenBuffers(1, &uniform_ring);
+		gl.BindBuffer(GL_UNIFORM_BUFFER, uniform_ring);
+		gl.BufferData(GL_UNIFORM_BUFFER, uniform_ring_size, nullptr, GL_STREAM_DRAW);
+
 		// create the default batch shader
 		default_batcher_shader = Shader::create(opengl_batch_shader_data);
+		default_batcher_instanced_shader = Shader::create(opengl_batch_instanced_shader_data);
+
+		// create the overdraw shaders, which reuse the batch vertex shaders
+		{
+			ShaderData data = opengl_batch_shader_data;
+			data.fragment = opengl_batch_overdraw_fragment_shader;
+			overdraw_batcher_shader = Shader::create(data);
+
+			data = opengl_batch_instanced_shader_data;
+			data.fragment = opengl_batch_overdraw_fragment_shader;
+			overdraw_batcher_instanced_shader = Shader::create(data);
+		}
 
 		return true;
 	}
 
 	void Renderer_OpenGL::shutdown()
 	{
+		for (auto& it : sampler_objects)
+			gl.DeleteSamplers(1, &it.id);
+		sampler_objects.clear();
+
+		gl.DeleteBuffers(1, &uniform_ring);
+		uniform_ring = 0;
+
 		App::Internal::platform->gl_context_destroy(context);
 		context = nullptr;
 	}
 
 	void Renderer_OpenGL::update() {}
-	void Renderer_OpenGL::before_render() {}
+	void Renderer_OpenGL::before_render()
+	{
+		// the platform or user code may have touched GL state between frames
+		invalidate_state();
+	}
+
 	void Renderer_OpenGL::after_render() {}
 
 	TextureRef Renderer_OpenGL::create_texture(int width, int height, TextureFormat format)
@@ -1289,17 +1708,99 @@ namespace Blah
 		return MeshRef(resource);
 	}
 
+	GLuint Renderer_OpenGL::get_sampler(const TextureSampler& sampler)
+	{
+		for (auto& it : sampler_objects)
+			if (it.sampler == sampler)
+				return it.id;
+
+		GLuint id = 0;
+		gl.GenSamplers(1, &id);
+		gl.SamplerParameteri(id, GL_TEXTURE_MIN_FILTER, (sampler.filter == TextureFilter::Nearest ? GL_NEAREST : GL_LINEAR));
+		gl.SamplerParameteri(id, GL_TEXTURE_MAG_FILTER, (sampler.filter == TextureFilter::Nearest ? GL_NEAREST : GL_LINEAR));
+		gl.SamplerParameteri(id, GL_TEXTURE_WRAP_S, (sampler.wrap_x == TextureWrap::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT));
+		gl.SamplerParameteri(id, GL_TEXTURE_WRAP_T, (sampler.wrap_y == TextureWrap::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT));
+
+		auto object = sampler_objects.expand();
+		object->sampler = sampler;
+		object->id = id;
+		return id;
+	}
+
+	GLint Renderer_OpenGL::get_uniform_binding(const char* name, GLint size)
+	{
+		for (int i = 0; i < uniform_bindings.size(); i++)
+			if (uniform_bindings[i].size == size && uniform_bindings[i].name == name)
+				return i;
+
+		if (size > uniform_ring_size)
+		{
+			Log::error("Uniform Block '%s' exceeds the maximum size of %i bytes", name, (int)uniform_ring_size);
+			return -1;
+		}
+
+		if (uniform_bindings.size() >= max_uniform_buffer_bindings)
+		{
+			Log::error("Exceeded Max Uniform Buffer Bindings of %i", max_uniform_buffer_bindings);
+			return -1;
+		}
+
+		auto binding = uniform_bindings.expand();
+		binding->name = name;
+		binding->size = size;
+		return uniform_bindings.size() - 1;
+	}
+
+	void Renderer_OpenGL::write_uniform_binding(GLuint binding, const u8* data, GLint size)
+	{
+		GLintptr offset = (uniform_ring_offset + uniform_buffer_alignment - 1) / uniform_buffer_alignment * uniform_buffer_alignment;
+
+		gl.BindBuffer(GL_UNIFORM_BUFFER, uniform_ring);
+
+		// orphan the buffer when it's full, so draws still reading the old ranges don't stall us
+		if (offset + size > uniform_ring_size)
+		{
+			gl.BufferData(GL_UNIFORM_BUFFER, uniform_ring_size, nullptr, GL_STREAM_DRAW);
+			offset = 0;
+
+			// the other bindings now point at ranges of the new, empty buffer
+			for (auto& it : uniform_bindings)
+				it.known = false;
+		}
+
+		// the range hasn't been written since the buffer was orphaned, so there's no need to synchronize
+		bool written = false;
+		if (gl.MapBufferRange)
+		{
+			void* dst = gl.MapBufferRange(GL_UNIFORM_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			if (dst)
+			{
+				memcpy(dst, data, size);
+
+				// unmapping fails if the contents were lost while mapped
+				written = (gl.UnmapBuffer(GL_UNIFORM_BUFFER) != 0);
+			}
+		}
+
+		// mapping isn't available everywhere (ex. WebGL2), so fall back to a regular upload
+		if (!written)
+			gl.BufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+
+		gl.BindBufferRange(GL_UNIFORM_BUFFER, binding, uniform_ring, offset, size);
+		uniform_ring_offset = offset + size;
+	}
+
 	void Renderer_OpenGL::render(const DrawCall& pass)
 	{
 		// Bind the Target
 		if (pass.target == App::backbuffer())
 		{
-			renderer->gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
+			bind_framebuffer(0);
 		}
 		else if (pass.target)
 		{
 			auto framebuffer = (OpenGL_Target*)pass.target.get();
-			renderer->gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer->gl_id());
+			bind_framebuffer(framebuffer->gl_id());
 		}
 
 		auto size = Point(pass.target->width(), pass.target->height());
@@ -1309,9 +1810,14 @@ namespace Blah
 
 		// Use the Shader
 		// TODO: I don't love how material values are assigned or set here
-		// TODO: this should be cached?
 		{
-			renderer->gl.UseProgram(shader->gl_id());
+			use_program(shader->gl_id());
+
+			// uniform values are kept by the program, so they only need uploading if the Material changed
+			auto material = pass.material.get();
+			bool upload = (shader->uploaded_material != material || shader->uploaded_generation != material->generation());
+			shader->uploaded_material = material;
+			shader->uploaded_generation = material->generation();
 
 			int texture_slot = 0;
 			GLint texture_ids[64];
@@ -1335,24 +1841,31 @@ namespace Blah
 						auto tex = pass.material->get_texture(texture_slot);
 						auto sampler = pass.material->get_sampler(texture_slot);
 
-						renderer->gl.ActiveTexture(GL_TEXTURE0 + texture_slot);
-
 						if (!tex)
-						{
-							renderer->gl.BindTexture(GL_TEXTURE_2D, 0);
-						}
+							bind_texture(texture_slot, 0);
 						else
-						{
-							auto gl_tex = ((OpenGL_Texture*)tex.get());
-							gl_tex->update_sampler(sampler);
-							renderer->gl.BindTexture(GL_TEXTURE_2D, gl_tex->gl_id());
-						}
+							bind_texture(texture_slot, ((OpenGL_Texture*)tex.get())->gl_id());
+
+						bind_sampler(texture_slot, get_sampler(sampler));
 
 						texture_ids[n] = texture_slot;
 						texture_slot++;
 					}
 
-					renderer->gl.Uniform1iv(location, (GLint)uniform.array_length, &texture_ids[0]);
+					if (upload)
+						renderer->gl.Uniform1iv(location, (GLint)uniform.array_length, &texture_ids[0]);
+					continue;
+				}
+
+				if (!upload)
+					continue;
+
+				// Uniform Block members are written with their block below
+				if (shader->uniform_members[i].block >= 0)
+				{
+					int columns, rows;
+					gl_get_uniform_shape(uniform.type, &columns, &rows);
+					data += columns * rows * uniform.array_length;
 					continue;
 				}
 
@@ -1393,9 +1906,67 @@ namespace Blah
 					data += 16 * uniform.array_length;
 				}
 			}
+
+			// Uniform Blocks
+			for (int b = 0; b < shader->uniform_blocks.size(); b++)
+			{
+				auto& block = shader->uniform_blocks[b];
+				auto& binding = uniform_bindings[block.binding];
+
+				// already bound by the last draw with this Material
+				if (binding.known && binding.material == material && binding.generation == material->generation())
+				{
+					stats.redundant_state_changes++;
+					continue;
+				}
+
+				// lay out the block in std140
+				uniform_scratch.clear();
+				uniform_scratch.expand(block.size);
+				{
+					const float* values = material->data();
+					for (int i = 0; i < uniforms.size(); i++)
+					{
+						auto& uniform = uniforms[i];
+						auto& member = shader->uniform_members[i];
+
+						int columns, rows;
+						gl_get_uniform_shape(uniform.type, &columns, &rows);
+
+						if (member.block == b)
+						{
+							for (int n = 0; n < uniform.array_length; n++)
+								for (int c = 0; c < columns; c++)
+								{
+									auto offset = member.offset + n * member.array_stride + c * member.matrix_stride;
+									memcpy(uniform_scratch.data() + offset, values + (n * columns + c) * rows, sizeof(float) * rows);
+								}
+						}
+
+						values += columns * rows * uniform.array_length;
+					}
+				}
+
+				binding.material = material;
+				binding.generation = material->generation();
+
+				// other Materials may share the same values, ex. the Batch matrix
+				if (binding.known && memcmp(binding.data.data(), uniform_scratch.data(), block.size) == 0)
+				{
+					stats.redundant_state_changes++;
+					continue;
+				}
+
+				write_uniform_binding(block.binding, uniform_scratch.data(), block.size);
+				binding.data = uniform_scratch;
+				binding.known = true;
+				stats.state_changes++;
+			}
 		}
 
 		// Blend Mode
+		set_enabled(state.blend_enabled, GL_BLEND, true);
+		if (state_changed(state.blend, pass.blend))
 		{
 			GLenum colorOp = gl_get_blend_func(pass.blend.color_op);
 			GLenum alphaOp = gl_get_blend_func(pass.blend.alpha_op);
@@ -1404,11 +1975,10 @@ namespace Blah
 			GLenum alphaSrc = gl_get_blend_factor(pass.blend.alpha_src);
 			GLenum alphaDst = gl_get_blend_factor(pass.blend.alpha_dst);
 
-			renderer->gl.Enable(GL_BLEND);
-			renderer->gl.BlendEquationSeparate(colorOp, alphaOp);
-			renderer->gl.BlendFuncSeparate(colorSrc, colorDst, alphaSrc, alphaDst);
+			gl.BlendEquationSeparate(colorOp, alphaOp);
+			gl.BlendFuncSeparate(colorSrc, colorDst, alphaSrc, alphaDst);
 
-			renderer->gl.ColorMask(
+			gl.ColorMask(
 				((int)pass.blend.mask & (int)BlendMask::Red),
 				((int)pass.blend.mask & (int)BlendMask::Green),
 				((int)pass.blend.mask & (int)BlendMask::Blue),
@@ -1419,7 +1989,7 @@ namespace Blah
 			unsigned char b = pass.blend.rgba >> 8;
 			unsigned char a = pass.blend.rgba;
 
-			renderer->gl.BlendColor(
+			gl.BlendColor(
 				r / 255.0f,
 				g / 255.0f,
 				b / 255.0f,
@@ -1427,62 +1997,70 @@ namespace Blah
 		}
 
 		// Depth Function
+		if (state_changed(state.depth, pass.depth))
 		{
 			if (pass.depth == Compare::None)
 			{
-				renderer->gl.Disable(GL_DEPTH_TEST);
+				gl.Disable(GL_DEPTH_TEST);
 			}
 			else
 			{
-				renderer->gl.Enable(GL_DEPTH_TEST);
+				gl.Enable(GL_DEPTH_TEST);
+				gl.DepthFunc(gl_get_compare(pass.depth));
+			}
+		}
 
-				switch (pass.depth)
+		// Stencil
+		{
+			StencilState stencil;
+			stencil.func = pass.stencil;
+			stencil.ref = pass.stencil_ref;
+			stencil.read_mask = pass.stencil_read_mask;
+			stencil.write_mask = pass.stencil_write_mask;
+			stencil.fail = pass.stencil_fail;
+			stencil.depth_fail = pass.stencil_depth_fail;
+			stencil.pass = pass.stencil_pass;
+
+			// the other stencil values don't matter while the test is disabled
+			if (stencil.func == Compare::None)
+				stencil = StencilState { Compare::None, 0, 0, 0, StencilOp::Keep, StencilOp::Keep, StencilOp::Keep };
+
+			if (state_changed(state.stencil, stencil))
+			{
+				if (pass.stencil == Compare::None)
 				{
-				case Compare::None: break;
-				case Compare::Always:
-					renderer->gl.DepthFunc(GL_ALWAYS);
-					break;
-				case Compare::Equal:
-					renderer->gl.DepthFunc(GL_EQUAL);
-					break;
-				case Compare::Greater:
-					renderer->gl.DepthFunc(GL_GREATER);
-					break;
-				case Compare::GreatorOrEqual:
-					renderer->gl.DepthFunc(GL_GEQUAL);
-					break;
-				case Compare::Less:
-					renderer->gl.DepthFunc(GL_LESS);
-					break;
-				case Compare::LessOrEqual:
-					renderer->gl.DepthFunc(GL_LEQUAL);
-					break;
-				case Compare::Never:
-					renderer->gl.DepthFunc(GL_NEVER);
-					break;
-				case Compare::NotEqual:
-					renderer->gl.DepthFunc(GL_NOTEQUAL);
-					break;
+					gl.Disable(GL_STENCIL_TEST);
+				}
+				else
+				{
+					gl.Enable(GL_STENCIL_TEST);
+					gl.StencilFunc(gl_get_compare(pass.stencil), pass.stencil_ref, pass.stencil_read_mask);
+					gl.StencilOp(
+						gl_get_stencil_op(pass.stencil_fail),
+						gl_get_stencil_op(pass.stencil_depth_fail),
+						gl_get_stencil_op(pass.stencil_pass));
+					gl.StencilMask(pass.stencil_write_mask);
 				}
 			}
 		}
 
 		// Cull Mode
+		if (state_changed(state.cull, pass.cull))
 		{
 			if (pass.cull == Cull::None)
 			{
-				renderer->gl.Disable(GL_CULL_FACE);
+				gl.Disable(GL_CULL_FACE);
 			}
 			else
 			{
-				renderer->gl.Enable(GL_CULL_FACE);
+				gl.Enable(GL_CULL_FACE);
 
 				if (pass.cull == Cull::Back)
-					renderer->gl.CullFace(GL_BACK);
+					gl.CullFace(GL_BACK);
 				else if (pass.cull == Cull::Front)
-					renderer->gl.CullFace(GL_FRONT);
+					gl.CullFace(GL_FRONT);
 				else
-					renderer->gl.CullFace(GL_FRONT_AND_BACK);
+					gl.CullFace(GL_FRONT_AND_BACK);
 			}
 		}
 
@@ -1491,14 +2069,16 @@ namespace Blah
 			Rectf viewport = pass.viewport;
 			viewport.y = size.y - viewport.y - viewport.h;
 
-			renderer->gl.Viewport((GLint)viewport.x, (GLint)viewport.y, (GLint)viewport.w, (GLint)viewport.h);
+			Recti rect = Recti((int)viewport.x, (int)viewport.y, (int)viewport.w, (int)viewport.h);
+			if (state_changed(state.viewport, rect))
+				gl.Viewport(rect.x, rect.y, rect.w, rect.h);
 		}
 
 		// Scissor
 		{
 			if (!pass.has_scissor)
 			{
-				renderer->gl.Disable(GL_SCISSOR_TEST);
+				set_enabled(state.scissor_enabled, GL_SCISSOR_TEST, false);
 			}
 			else
 			{
@@ -1510,20 +2090,23 @@ namespace Blah
 				if (scissor.h < 0)
 					scissor.h = 0;
 
-				renderer->gl.Enable(GL_SCISSOR_TEST);
-				renderer->gl.Scissor((GLint)scissor.x, (GLint)scissor.y, (GLint)scissor.w, (GLint)scissor.h);
+				Recti rect = Recti((int)scissor.x, (int)scissor.y, (int)scissor.w, (int)scissor.h);
+				set_enabled(state.scissor_enabled, GL_SCISSOR_TEST, true);
+				if (state_changed(state.scissor, rect))
+					gl.Scissor(rect.x, rect.y, rect.w, rect.h);
 			}
 		}
 
 		// Draw the Mesh
 		{
-			renderer->gl.BindVertexArray(mesh->gl_id());
+			bind_vertex_array(mesh->gl_id());
 
 			GLenum index_format = mesh->gl_index_format();
 			int index_size = mesh->gl_index_size();
 
 			if (pass.instance_count > 0)
 			{
+				mesh->gl_set_instance_start(pass.instance_start);
 				renderer->gl.DrawElementsInstanced(
 					GL_TRIANGLES,
 					(GLint)(pass.index_count),
@@ -1539,40 +2122,50 @@ namespace Blah
 					index_format,
 					(void*)(index_size * pass.index_start));
 			}
-
-			renderer->gl.BindVertexArray(0);
 		}
 	}
 
 	void Renderer_OpenGL::clear_backbuffer(Color color, float depth, u8 stencil, ClearMask mask)
 	{
-			renderer->gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
-			renderer->gl.Disable(GL_SCISSOR_TEST);
+		clear(0, color, depth, stencil, mask);
+	}
+
+	void Renderer_OpenGL::clear(GLuint framebuffer, Color color, float depth, u8 stencil, ClearMask mask)
+	{
+		bind_framebuffer(framebuffer);
+		set_enabled(state.scissor_enabled, GL_SCISSOR_TEST, false);
 
-			int clear = 0;
+		int clear = 0;
 
-			if (((int)mask & (int)ClearMask::Color) == (int)ClearMask::Color)
-			{
-				clear |= GL_COLOR_BUFFER_BIT;
-				renderer->gl.ColorMask(true, true, true, true);
-				renderer->gl.ClearColor(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f);
-			}
-			
-			if (((int)mask & (int)ClearMask::Depth) == (int)ClearMask::Depth)
-			{
-				clear |= GL_DEPTH_BUFFER_BIT;
-				if (renderer->gl.ClearDepth)
-					renderer->gl.ClearDepth(depth);
-			}
+		if (((int)mask & (int)ClearMask::Color) == (int)ClearMask::Color)
+		{
+			clear |= GL_COLOR_BUFFER_BIT;
+			gl.ColorMask(true, true, true, true);
+			gl.ClearColor(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f);
 
-			if (((int)mask & (int)ClearMask::Stencil) == (int)ClearMask::Stencil)
-			{
-				clear |= GL_STENCIL_BUFFER_BIT;
-				if (renderer->gl.ClearStencil)
-					renderer->gl.ClearStencil(stencil);
-			}
+			// the color mask is part of the blend state
+			state.blend.known = false;
+		}
+
+		if (((int)mask & (int)ClearMask::Depth) == (int)ClearMask::Depth)
+		{
+			clear |= GL_DEPTH_BUFFER_BIT;
+			if (gl.ClearDepth)
+				gl.ClearDepth(depth);
+		}
+
+		if (((int)mask & (int)ClearMask::Stencil) == (int)ClearMask::Stencil)
+		{
+			clear |= GL_STENCIL_BUFFER_BIT;
+			gl.StencilMask(0xff);
+			if (gl.ClearStencil)
+				gl.ClearStencil(stencil);
+
+			// the stencil write mask is part of the stencil state
+			state.stencil.known = false;
+		}
 
-			renderer->gl.Clear(clear);
+		gl.Clear(clear);
 	}
 }
 